@@ -5,14 +5,83 @@
 #ifndef BASE_CW_EMF_H
 #define BASE_CW_EMF_H
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <numbers>
+#include <stdexcept>
+#include <string>
 #include <string_view>
+#include <thread>
 #include <tuple>
+#include <vector>
 #include <chrono>
 #include <concepts>
 
+#if !defined(CW_EMF_AWS_SDK) && __has_include(<aws/monitoring/model/StandardUnit.h>)
+#define CW_EMF_AWS_SDK 1
+#endif
+
+#if CW_EMF_AWS_SDK
 #include <aws/monitoring/model/StandardUnit.h>
+#endif
+
+#if defined(__SSE2__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#if defined(__linux__)
+#include <linux/membarrier.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 namespace cw_emf {
+
+    /**
+     * CloudWatch metric units
+     */
+    enum class unit {
+        Seconds,
+        Microseconds,
+        Milliseconds,
+        Bytes,
+        Kilobytes,
+        Megabytes,
+        Gigabytes,
+        Terabytes,
+        Bits,
+        Kilobits,
+        Megabits,
+        Gigabits,
+        Terabits,
+        Percent,
+        Count,
+        Bytes_Second,
+        Kilobytes_Second,
+        Megabytes_Second,
+        Gigabytes_Second,
+        Terabytes_Second,
+        Bits_Second,
+        Kilobits_Second,
+        Megabits_Second,
+        Gigabits_Second,
+        Terabits_Second,
+        Count_Second,
+        None
+    };
+
     namespace internal {
 
         template<int N> struct named {
@@ -24,7 +93,10 @@ namespace cw_emf {
             constexpr auto operator<=>(named const&) const = default;
 
             constexpr std::string_view name() const {
-                return &m_elems[0];
+                if constexpr(N == 0)
+                    return {};
+                else
+                    return {m_elems, N - 1};
             }
 
 
@@ -36,18 +108,554 @@ namespace cw_emf {
         template<int N> named(char const(&)[N])->named<N>;
         named(std::nullptr_t n) ->named<0>;
 
+        /**
+         * Number of types in items_t with a static name() equal to name
+         */
+        template<named name, typename... items_t>
+        consteval int count_by_name() {
+            return (0 + ... + (items_t::name() == name.name() ? 1 : 0));
+        }
+
+        /**
+         * Resolves name to the position of the matching type in items_t, unknown and duplicate names fail to compile
+         */
+        template<named name, typename... items_t>
+        consteval int index_by_name() {
+            static_assert(count_by_name<name, items_t...>() > 0, "No metric, dimension or log message with this name");
+            static_assert(count_by_name<name, items_t...>() < 2, "Name is not unique, use indexed access instead");
+
+            constexpr std::array<std::string_view, sizeof...(items_t)> names{items_t::name()...};
+            return static_cast<int>(std::find(names.begin(), names.end(), name.name()) - names.begin());
+        }
+
+        /**
+         * Pre-rendered JSON text of a fixed size
+         */
+        template<std::size_t N> struct fragment {
+
+            constexpr std::string_view view() const {
+                return {m_elems.data(), N};
+            }
+
+            std::array<char, N> m_elems;
+        };
+
+        /**
+         * Renders the std::string returned by render at compile time into a fragment
+         */
+        template<auto render> consteval auto make_fragment() {
+            constexpr std::size_t size = render().size();
+
+            fragment<size> result{};
+            auto text = render();
+            std::copy_n(text.data(), size, result.m_elems.begin());
+
+            return result;
+        }
+
+        constexpr bool needs_escape(unsigned char c) {
+            return c < 0x20 || c == '"' || c == '\\';
+        }
+
+        /**
+         * Appends the JSON escape sequence of a character that needs_escape
+         */
+        constexpr void escape_char(auto& out, unsigned char c) {
+            switch (c) {
+                case '"': out += "\\\""; break;
+                case '\\': out += "\\\\"; break;
+                case '\b': out += "\\b"; break;
+                case '\f': out += "\\f"; break;
+                case '\n': out += "\\n"; break;
+                case '\r': out += "\\r"; break;
+                case '\t': out += "\\t"; break;
+                default:
+                    constexpr std::string_view hex{"0123456789abcdef"};
+                    out += "\\u00";
+                    out += hex[c >> 4];
+                    out += hex[c & 0x0F];
+            }
+        }
+
+        /**
+         * Offset of the first character in text that needs escaping, or that is not ASCII when non_ascii is set
+         */
+        constexpr std::size_t find_escape_scalar(std::string_view text, bool non_ascii) {
+            for (std::size_t i=0; i < text.size(); ++i) {
+                auto c = static_cast<unsigned char>(text[i]);
+                if (needs_escape(c) || (non_ascii && c >= 0x80))
+                    return i;
+            }
+            return text.size();
+        }
+
+        /**
+         * Same as find_escape_scalar, but skipping over runs of clean characters 32 or 16 at a time
+         */
+        inline std::size_t find_escape(std::string_view text, bool non_ascii) {
+            std::size_t offset{0};
+
+#if defined(__AVX2__)
+            const __m256i control_32 = _mm256_set1_epi8(0x1F);
+            const __m256i quote_32 = _mm256_set1_epi8('"');
+            const __m256i backslash_32 = _mm256_set1_epi8('\\');
+
+            for (; offset + 32 <= text.size(); offset += 32) {
+                __m256i chars = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(text.data() + offset));
+
+                __m256i escape = _mm256_or_si256(
+                        _mm256_cmpeq_epi8(_mm256_max_epu8(chars, control_32), control_32),
+                        _mm256_or_si256(_mm256_cmpeq_epi8(chars, quote_32), _mm256_cmpeq_epi8(chars, backslash_32)));
+                if (non_ascii)
+                    escape = _mm256_or_si256(escape, chars);
+
+                if (auto mask = static_cast<std::uint32_t>(_mm256_movemask_epi8(escape)))
+                    return offset + std::countr_zero(mask);
+            }
+#endif
+#if defined(__SSE2__)
+            const __m128i control_16 = _mm_set1_epi8(0x1F);
+            const __m128i quote_16 = _mm_set1_epi8('"');
+            const __m128i backslash_16 = _mm_set1_epi8('\\');
+
+            for (; offset + 16 <= text.size(); offset += 16) {
+                __m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text.data() + offset));
+
+                __m128i escape = _mm_or_si128(
+                        _mm_cmpeq_epi8(_mm_max_epu8(chars, control_16), control_16),
+                        _mm_or_si128(_mm_cmpeq_epi8(chars, quote_16), _mm_cmpeq_epi8(chars, backslash_16)));
+                if (non_ascii)
+                    escape = _mm_or_si128(escape, chars);
+
+                if (auto mask = static_cast<std::uint32_t>(_mm_movemask_epi8(escape)))
+                    return offset + std::countr_zero(mask);
+            }
+#endif
+
+            return offset + find_escape_scalar(text.substr(offset), non_ascii);
+        }
+
+        /**
+         * Length of the well formed UTF-8 sequence at the start of text, 0 if there is none
+         */
+        constexpr std::size_t utf8_sequence_length(std::string_view text) {
+            auto byte = [&](std::size_t i) { return static_cast<unsigned char>(text[i]); };
+            auto continuation = [&](std::size_t i) { return i < text.size() && (byte(i) & 0xC0) == 0x80; };
+
+            unsigned char lead = byte(0);
+            if (lead < 0x80)
+                return 1;
+            if (lead >= 0xC2 && lead <= 0xDF)
+                return continuation(1) ? 2 : 0;
+            if (lead >= 0xE0 && lead <= 0xEF) {
+                // no overlong encodings and no surrogates
+                if (!continuation(1) || !continuation(2)
+                    || (lead == 0xE0 && byte(1) < 0xA0) || (lead == 0xED && byte(1) > 0x9F))
+                    return 0;
+                return 3;
+            }
+            if (lead >= 0xF0 && lead <= 0xF4) {
+                // no overlong encodings and nothing above U+10FFFF
+                if (!continuation(1) || !continuation(2) || !continuation(3)
+                    || (lead == 0xF0 && byte(1) < 0x90) || (lead == 0xF4 && byte(1) > 0x8F))
+                    return 0;
+                return 4;
+            }
+            return 0;
+        }
+
+        /**
+         * Appends value as a quoted JSON string. With validate_utf8, malformed UTF-8 is replaced by U+FFFD
+         */
+        constexpr void write_json_string(auto& out, std::string_view value, bool validate_utf8 = false) {
+            out.reserve(out.size() + value.size() + 2);
+            out += '"';
+
+            while (!value.empty()) {
+                std::size_t clean = std::is_constant_evaluated() ? find_escape_scalar(value, validate_utf8) : find_escape(value, validate_utf8);
+                out.append(value.data(), clean);
+                value.remove_prefix(clean);
+
+                if (value.empty())
+                    break;
+
+                auto c = static_cast<unsigned char>(value.front());
+                if (c < 0x80) {
+                    escape_char(out, c);
+                    value.remove_prefix(1);
+                } else if (auto length = utf8_sequence_length(value)) {
+                    out.append(value.data(), length);
+                    value.remove_prefix(length);
+                } else {
+                    out += "\xEF\xBF\xBD";
+                    value.remove_prefix(1);
+                }
+            }
+
+            out += '"';
+        }
+
+        constexpr std::string json_string(std::string_view value) {
+            std::string result;
+            write_json_string(result, value);
+            return result;
+        }
+
+        constexpr std::string json_key(std::string_view name) {
+            return json_string(name) + ':';
+        }
+
+        /**
+         * CloudWatch name of a unit
+         */
+        constexpr std::string_view unit_name(unit metric_unit) {
+            constexpr std::array<std::string_view, static_cast<std::size_t>(unit::None) + 1> names{
+                "Seconds", "Microseconds", "Milliseconds",
+                "Bytes", "Kilobytes", "Megabytes", "Gigabytes", "Terabytes",
+                "Bits", "Kilobits", "Megabits", "Gigabits", "Terabits",
+                "Percent", "Count",
+                "Bytes/Second", "Kilobytes/Second", "Megabytes/Second", "Gigabytes/Second", "Terabytes/Second",
+                "Bits/Second", "Kilobits/Second", "Megabits/Second", "Gigabits/Second", "Terabits/Second",
+                "Count/Second", "None"
+            };
+
+            return names[static_cast<std::size_t>(metric_unit)];
+        }
+
+        constexpr unit to_unit(unit metric_unit) {
+            return metric_unit;
+        }
+
+#if CW_EMF_AWS_SDK
+        /**
+         * Compatibility with metrics declared with the AWS SDK unit enum
+         */
+        constexpr unit to_unit(Aws::CloudWatch::Model::StandardUnit metric_unit) {
+            using Aws::CloudWatch::Model::StandardUnit;
+
+            switch (metric_unit) {
+                case StandardUnit::Seconds: return unit::Seconds;
+                case StandardUnit::Microseconds: return unit::Microseconds;
+                case StandardUnit::Milliseconds: return unit::Milliseconds;
+                case StandardUnit::Bytes: return unit::Bytes;
+                case StandardUnit::Kilobytes: return unit::Kilobytes;
+                case StandardUnit::Megabytes: return unit::Megabytes;
+                case StandardUnit::Gigabytes: return unit::Gigabytes;
+                case StandardUnit::Terabytes: return unit::Terabytes;
+                case StandardUnit::Bits: return unit::Bits;
+                case StandardUnit::Kilobits: return unit::Kilobits;
+                case StandardUnit::Megabits: return unit::Megabits;
+                case StandardUnit::Gigabits: return unit::Gigabits;
+                case StandardUnit::Terabits: return unit::Terabits;
+                case StandardUnit::Percent: return unit::Percent;
+                case StandardUnit::Count: return unit::Count;
+                case StandardUnit::Bytes_Second: return unit::Bytes_Second;
+                case StandardUnit::Kilobytes_Second: return unit::Kilobytes_Second;
+                case StandardUnit::Megabytes_Second: return unit::Megabytes_Second;
+                case StandardUnit::Gigabytes_Second: return unit::Gigabytes_Second;
+                case StandardUnit::Terabytes_Second: return unit::Terabytes_Second;
+                case StandardUnit::Bits_Second: return unit::Bits_Second;
+                case StandardUnit::Kilobits_Second: return unit::Kilobits_Second;
+                case StandardUnit::Megabits_Second: return unit::Megabits_Second;
+                case StandardUnit::Gigabits_Second: return unit::Gigabits_Second;
+                case StandardUnit::Terabits_Second: return unit::Terabits_Second;
+                case StandardUnit::Count_Second: return unit::Count_Second;
+                default: return unit::None;
+            }
+        }
+#endif
+
+        template<typename U> concept unit_c = requires(U metric_unit) {
+            { to_unit(metric_unit) } -> std::same_as<unit>;
+        };
+
+        /**
+         * How floating point values are written, a negative precision is the shortest round trip representation
+         */
+        struct number_format {
+            std::chars_format format;
+            int precision;
+        };
+
+        constexpr number_format shortest_format{std::chars_format::general, -1};
+
+        /**
+         * Upper bound of the characters std::to_chars writes for value_type in the given format
+         */
+        template<typename value_type>
+        constexpr std::size_t max_chars(number_format format = shortest_format) {
+            using limits = std::numeric_limits<value_type>;
+
+            if constexpr(std::integral<value_type>) {
+                return limits::digits10 + 2;
+            } else {
+                // sign, decimal point, exponent marker, exponent sign and exponent digits
+                constexpr std::size_t exponent = 4 + (limits::max_exponent10 < 1000 ? 3 : 5);
+
+                if (format.precision < 0)
+                    return limits::max_digits10 + exponent;
+                else if (format.format == std::chars_format::fixed)
+                    return limits::max_exponent10 + 3 + format.precision;
+                else
+                    return format.precision + exponent + 1;
+            }
+        }
+
+        /**
+         * Metric options are selected by their option_tag, the first one given wins
+         */
+        template<typename tag, typename default_t, typename... options_t> struct find_option {
+            using type = default_t;
+        };
+
+        template<typename tag, typename default_t, typename option_t, typename... options_t>
+        struct find_option<tag, default_t, option_t, options_t...> {
+            using type = std::conditional_t<std::is_same_v<typename option_t::option_tag, tag>,
+                    option_t,
+                    typename find_option<tag, default_t, options_t...>::type>;
+        };
+
+        struct precision_tag {};
+        struct inline_capacity_tag {};
+        struct values_counts_tag {};
+
+        struct no_counts {};
+
+        /**
+         * Vector of trivially copyable values that keeps the first inline_capacity values inside the object
+         * and only moves them to memory from its memory resource once it grows past that
+         */
+        template<typename T, std::size_t inline_capacity>
+        class small_vector {
+            static_assert(std::is_trivially_copyable_v<T>, "small_vector only holds trivially copyable values");
+
+        public:
+            small_vector() = default;
+
+            explicit small_vector(std::pmr::memory_resource* resource): m_resource{resource} {}
+
+            small_vector(const small_vector& other) {
+                append(other.data(), other.size());
+            }
+
+            small_vector(small_vector&& other) noexcept: m_resource{other.m_resource} {
+                take(other);
+            }
+
+            small_vector& operator=(const small_vector& other) {
+                if (this != &other) {
+                    clear();
+                    append(other.data(), other.size());
+                }
+                return *this;
+            }
+
+            small_vector& operator=(small_vector&& other) {
+                if (this != &other) {
+                    if (other.is_inline() || *m_resource == *other.m_resource) {
+                        release();
+                        take(other);
+                    } else {
+                        clear();
+                        append(other.data(), other.size());
+                        other.clear();
+                    }
+                }
+                return *this;
+            }
+
+            ~small_vector() {
+                release();
+            }
+
+            void push_back(T value) {
+                if (m_size == m_capacity)
+                    reserve(m_capacity == 0 ? 8 : m_capacity * 2);
+                m_data[m_size++] = value;
+            }
+
+            void reserve(std::size_t capacity) {
+                if (capacity <= m_capacity)
+                    return;
+
+                T* data = static_cast<T*>(m_resource->allocate(capacity * sizeof(T), alignof(T)));
+                std::copy_n(m_data, m_size, data);
+
+                release();
+                m_data = data;
+                m_capacity = capacity;
+            }
+
+            void clear() {
+                m_size = 0;
+            }
+
+            T operator[](std::size_t index) const {
+                return m_data[index];
+            }
+
+            T& operator[](std::size_t index) {
+                return m_data[index];
+            }
+
+            void insert(std::size_t index, T value) {
+                if (m_size == m_capacity)
+                    reserve(m_capacity == 0 ? 8 : m_capacity * 2);
+                std::copy_backward(m_data + index, m_data + m_size, m_data + m_size + 1);
+                m_data[index] = value;
+                ++m_size;
+            }
+
+            T at(std::size_t index) const {
+                if (index >= m_size)
+                    throw std::out_of_range("small_vector::at");
+                return m_data[index];
+            }
+
+            std::size_t size() const {
+                return m_size;
+            }
+
+            std::size_t capacity() const {
+                return m_capacity;
+            }
+
+            bool is_inline() const {
+                return m_data == m_inline.data();
+            }
+
+            std::pmr::memory_resource* resource() const {
+                return m_resource;
+            }
+
+            const T* data() const {
+                return m_data;
+            }
+
+            T* data() {
+                return m_data;
+            }
+
+            const T* begin() const {
+                return m_data;
+            }
+
+            const T* end() const {
+                return m_data + m_size;
+            }
+
+        private:
+            std::array<T, inline_capacity> m_inline;
+            T* m_data{m_inline.data()};
+            std::size_t m_size{0};
+            std::size_t m_capacity{inline_capacity};
+            std::pmr::memory_resource* m_resource{std::pmr::get_default_resource()};
+
+            void append(const T* values, std::size_t count) {
+                reserve(m_size + count);
+                std::copy_n(values, count, m_data + m_size);
+                m_size += count;
+            }
+
+            void take(small_vector& other) {
+                if (other.is_inline()) {
+                    m_data = m_inline.data();
+                    m_capacity = inline_capacity;
+                    std::copy_n(other.m_data, other.m_size, m_data);
+                } else {
+                    m_data = other.m_data;
+                    m_capacity = other.m_capacity;
+                    other.m_data = other.m_inline.data();
+                    other.m_capacity = inline_capacity;
+                }
+                m_size = other.m_size;
+                other.m_size = 0;
+            }
+
+            void release() {
+                if (!is_inline())
+                    m_resource->deallocate(m_data, m_capacity * sizeof(T), alignof(T));
+                m_data = m_inline.data();
+                m_capacity = inline_capacity;
+            }
+        };
+
+        /**
+         * A memory resource that only converts to std::pmr::memory_resource*. A plain pointer also converts to bool
+         * and would end up in a parameter like validate_utf8.
+         */
+        struct resource_argument {
+            std::pmr::memory_resource* resource;
+
+            template<typename T> requires std::same_as<T, std::pmr::memory_resource*>
+            operator T() const {
+                return resource;
+            }
+        };
+
+        /**
+         * Constructs T with the memory resource when it takes one, otherwise default constructs it
+         */
+        template<typename T> T make_with_resource(std::pmr::memory_resource* resource) {
+            if constexpr(std::constructible_from<T, resource_argument>)
+                return T(resource_argument{resource});
+            else
+                return T();
+        }
+
+        /**
+         * Format of a metric's values, metrics without a format() use the shortest representation
+         */
+        template<typename M> constexpr number_format format_of() {
+            if constexpr(requires { { M::format() } -> std::same_as<number_format>; })
+                return M::format();
+            else
+                return shortest_format;
+        }
+
         template<typename M> concept emf_metric_c = requires (M metric, typename M::type value){
 
+            { M::name() } -> std::same_as<std::string_view>;
             { metric.name() } -> std::same_as<std::string_view>;
-            { metric.unit_name() } -> std::same_as<std::string>;
+            { M::unit_name() } -> std::same_as<std::string_view>;
+            { metric.unit_name() } -> std::same_as<std::string_view>;
 
             { metric.put_value(value) };
 
             { metric.size() } -> std::same_as<std::size_t>;
         };
 
+        /**
+         * A metric holding at most max_values() values
+         */
+        template<typename M> concept emf_bounded_metric_c = emf_metric_c<M> && requires {
+            { M::max_values() } -> std::same_as<std::size_t>;
+        };
+
+        /**
+         * A metric holding distinct values with the number of times each was put, written as Values and Counts
+         */
+        template<typename M> concept emf_counted_metric_c = emf_metric_c<M> && requires(M metric) {
+            { metric.count_at(0) } -> std::same_as<std::size_t>;
+        };
+
+        /**
+         * A metric that can take the values of another metric of the same type
+         */
+        template<typename M> concept emf_mergeable_metric_c = emf_metric_c<M> && requires(M metric, const M& other) {
+            { metric.merge(other) };
+        };
+
+        /**
+         * Upper bound of a JSON string holding size bytes, when every byte is written as an escape sequence
+         */
+        constexpr std::size_t max_json_string_size(std::size_t size) {
+            return 2 + 6 * size;
+        }
+
         template<typename D> concept emf_dimension_c = requires(D dimension) {
 
+            { D::name() } -> std::same_as<std::string_view>;
             { dimension.name() } -> std::same_as<std::string_view>;
 
             { dimension.value() } -> std::same_as<std::string_view>;
@@ -55,6 +663,7 @@ namespace cw_emf {
 
         template<typename D> concept emf_log_message_c = requires(D msg) {
 
+            { D::name() } -> std::same_as<std::string_view>;
             { msg.name() } -> std::same_as<std::string_view>;
 
             { msg.value() } -> std::same_as<std::string_view>;
@@ -94,6 +703,30 @@ namespace cw_emf {
 
         };
 
+        /**
+         * A sink that can take pre-rendered JSON fragments, these have static storage duration
+         */
+        template<typename S> concept emf_fragment_sink_c = emf_msg_sink_c<S> && requires(S sink, std::string_view fragment) {
+            { sink.write_fragment(fragment) };
+        };
+
+        /**
+         * A sink that limits the size of each message, including its newline. The logger writes fewer values per
+         * message until all of them fit and uses size() and truncate() to take back messages that did not.
+         */
+        template<typename S> concept emf_size_limited_sink_c = emf_msg_sink_c<S> && requires(S sink, std::size_t size) {
+            { S::max_message_size() } -> std::convertible_to<std::size_t>;
+            { sink.size() } -> std::convertible_to<std::size_t>;
+            { sink.truncate(size) };
+        };
+
+        /**
+         * A dimension whose value is known at compile time
+         */
+        template<typename D> concept emf_static_dimension_c = emf_dimension_c<D> && requires {
+            { D::value() } -> std::same_as<std::string_view>;
+        };
+
     }
 
 
@@ -101,170 +734,1309 @@ namespace cw_emf {
      * Metrics Classes
      */
 
-    template<internal::named metric_name, Aws::CloudWatch::Model::StandardUnit unit, typename value_type = double>
+    /**
+     * Metric option writing floating point values with a fixed number of digits instead of the shortest round trip form
+     */
+    template<int digits, std::chars_format format = std::chars_format::fixed>
+    struct precision {
+        using option_tag = internal::precision_tag;
+
+        static constexpr internal::number_format number_format{format, digits};
+    };
+
+    /**
+     * Metric option setting how many values are kept inside the metric before its storage moves to the heap
+     */
+    template<std::size_t capacity>
+    struct inline_capacity {
+        using option_tag = internal::inline_capacity_tag;
+
+        static constexpr std::size_t value = capacity;
+    };
+
+    /**
+     * Metric option keeping each distinct value once with the number of times it was put, the metric is then written
+     * as {"Values":[...],"Counts":[...]} and repeated values no longer count towards the 100 values of a message.
+     *
+     * The distinct values are kept sorted in a vector, putting a new one moves the larger ones, so n distinct values
+     * cost O(n^2) in all. It is meant for few distinct values like status codes, histogram_metric and sketch_metric
+     * count many of them in fixed memory. NaN is dropped, it has no place in the order and no JSON representation.
+     */
+    struct values_counts {
+        using option_tag = internal::values_counts_tag;
+    };
+
+    template<internal::named metric_name, internal::unit_c auto metric_unit, typename value_type = double, typename... options_t>
     class metric {
 
+        using precision_t = typename internal::find_option<internal::precision_tag, void, options_t...>::type;
+        using inline_capacity_t = typename internal::find_option<internal::inline_capacity_tag, inline_capacity<8>, options_t...>::type;
+
+        static constexpr bool counted = !std::is_void_v<typename internal::find_option<internal::values_counts_tag, void, options_t...>::type>;
+
+        using counts_t = std::conditional_t<counted, internal::small_vector<std::size_t, inline_capacity_t::value>, internal::no_counts>;
+
     public:
         using type = value_type;
 
-        std::string_view name() const {
+        static constexpr std::string_view name() {
             return metric_name.name();
         }
 
-        std::string unit_name() const {
-            return Aws::CloudWatch::Model::StandardUnitMapper::GetNameForStandardUnit(unit);
+        static constexpr std::string_view unit_name() {
+            return internal::unit_name(internal::to_unit(metric_unit));
         }
 
+        metric() = default;
+
+        /**
+         * Values past the inline capacity are allocated from resource
+         */
+        explicit metric(std::pmr::memory_resource* resource): m_values{resource}, m_counts{make_counts(resource)} {}
+
+        static constexpr internal::number_format format() {
+            if constexpr(std::is_void_v<precision_t>)
+                return internal::shortest_format;
+            else
+                return precision_t::number_format;
+        }
+
+        /**
+         * With values_counts the values are kept sorted and a value already seen only increments its count, NaN is
+         * dropped
+         */
         void put_value(type value) {
-            m_values.push_back(value);
+            if constexpr(counted)
+                add(value, 1);
+            else
+                m_values.push_back(value);
+        }
+
+        /**
+         * Adds the values of other after the values of this metric
+         */
+        void merge(const metric& other) {
+            for (std::size_t i=0; i < other.size(); ++i) {
+                if constexpr(counted)
+                    add(other.m_values[i], other.m_counts[i]);
+                else
+                    m_values.push_back(other.m_values[i]);
+            }
         }
 
         type value_at(std::size_t index) const {
             return m_values.at(index);
         }
 
+        std::size_t count_at(std::size_t index) const requires counted {
+            return m_counts.at(index);
+        }
+
+        /**
+         * Number of values, or of distinct values with values_counts
+         */
         constexpr std::size_t size() const {
             return m_values.size();
         }
 
     private:
-        std::vector<type> m_values;
+        internal::small_vector<type, inline_capacity_t::value> m_values;
+        [[no_unique_address]] counts_t m_counts;
+
+        void add(type value, std::size_t count) requires counted {
+            if constexpr(std::is_floating_point_v<type>) {
+                if (std::isnan(value))
+                    return;
+            }
+
+            std::size_t index = std::lower_bound(m_values.begin(), m_values.end(), value) - m_values.begin();
+            if (index < m_values.size() && m_values[index] == value) {
+                m_counts[index] += count;
+            } else {
+                m_values.insert(index, value);
+                m_counts.insert(index, count);
+            }
+        }
+
+        static counts_t make_counts(std::pmr::memory_resource* resource) {
+            if constexpr(counted)
+                return counts_t(resource);
+            else
+                return {};
+        }
+    };
+
+    /**
+     * What a bounded_metric does with values put after it is full
+     */
+    enum class overflow {
+        drop,               // the new value is dropped
+        overwrite_oldest,   // the new value replaces the oldest one
+        count               // the new value is dropped and counted in overflows()
+    };
+
+    /**
+     * Metric with storage for max_values values inside the object, it never allocates
+     */
+    template<internal::named metric_name, internal::unit_c auto metric_unit, std::size_t max_values_v,
+            typename value_type = double, overflow overflow_v = overflow::drop, typename... options_t>
+    class bounded_metric {
+        static_assert(max_values_v > 0, "A bounded metric needs room for at least one value");
+
+        using precision_t = typename internal::find_option<internal::precision_tag, void, options_t...>::type;
+
+    public:
+        using type = value_type;
+
+        static constexpr std::string_view name() {
+            return metric_name.name();
+        }
+
+        static constexpr std::string_view unit_name() {
+            return internal::unit_name(internal::to_unit(metric_unit));
+        }
+
+        static constexpr internal::number_format format() {
+            if constexpr(std::is_void_v<precision_t>)
+                return internal::shortest_format;
+            else
+                return precision_t::number_format;
+        }
+
+        static constexpr std::size_t max_values() {
+            return max_values_v;
+        }
+
+        static constexpr overflow overflow_policy() {
+            return overflow_v;
+        }
+
+        void put_value(type value) {
+            if constexpr(overflow_v == overflow::overwrite_oldest) {
+                m_values[m_next] = value;
+                m_next = (m_next + 1) % max_values_v;
+                if (m_size < max_values_v)
+                    ++m_size;
+            } else {
+                if (m_size == max_values_v) {
+                    if constexpr(overflow_v == overflow::count)
+                        ++m_overflows;
+                    return;
+                }
+                m_values[m_size++] = value;
+            }
+        }
+
+        /**
+         * Puts the values of other, oldest first, and adds its overflows
+         */
+        void merge(const bounded_metric& other) {
+            for (std::size_t i=0; i < other.size(); ++i)
+                put_value(other.value_at(i));
+            m_overflows += other.m_overflows;
+        }
+
+        /**
+         * Values are in the order they were put, oldest first
+         */
+        type value_at(std::size_t index) const {
+            if (index >= m_size)
+                throw std::out_of_range("bounded_metric::value_at");
+
+            if constexpr(overflow_v == overflow::overwrite_oldest)
+                return m_values[(m_next + max_values_v - m_size + index) % max_values_v];
+            else
+                return m_values[index];
+        }
+
+        constexpr std::size_t size() const {
+            return m_size;
+        }
+
+        /**
+         * Number of values dropped with overflow::count
+         */
+        std::size_t overflows() const {
+            return m_overflows;
+        }
+
+    private:
+        std::array<type, max_values_v> m_values;
+        std::size_t m_size{0};
+        std::size_t m_next{0};
+        std::size_t m_overflows{0};
+    };
+
+    /**
+     * Metric counting values in log-linear buckets with a fixed memory footprint, written as Values and Counts with
+     * the bucket midpoints as values.
+     *
+     * Each power of two between 2^min_exponent and 2^max_exponent is split into 2^precision buckets, so a value is
+     * off by at most 2^-(precision+1) of itself. Values below the range are counted in the lowest bucket, values above
+     * it in the highest one, zero, negative values and NaN in a bucket of their own written as 0. A bucket counts up
+     * to 2^32 - 1 values and stays there, like the overflows of packed_metrics.
+     */
+    template<internal::named metric_name, internal::unit_c auto metric_unit, int precision = 4,
+            int min_exponent = -20, int max_exponent = 40>
+    class histogram_metric {
+        static_assert(precision >= 0 && precision <= 16, "precision is the number of mantissa bits, from 0 to 16");
+        static_assert(min_exponent < max_exponent && min_exponent >= -1022 && max_exponent <= 1024);
+
+        static constexpr std::size_t value_buckets = static_cast<std::size_t>(max_exponent - min_exponent) << precision;
+
+    public:
+        using type = double;
+
+        static constexpr std::string_view name() {
+            return metric_name.name();
+        }
+
+        static constexpr std::string_view unit_name() {
+            return internal::unit_name(internal::to_unit(metric_unit));
+        }
+
+        /**
+         * Number of buckets, including the one for zero
+         */
+        static constexpr std::size_t buckets() {
+            return value_buckets + 1;
+        }
+
+        void put_value(type value) {
+            auto bits = std::bit_cast<std::uint64_t>(value);
+            auto exponent = static_cast<std::int64_t>((bits >> 52) & 0x7ff) - 1023;
+            auto mantissa = static_cast<std::int64_t>((bits >> (52 - precision)) & ((1 << precision) - 1));
+
+            auto bucket = std::clamp<std::int64_t>(((exponent - min_exponent) << precision) | mantissa, 0, value_buckets - 1) + 1;
+            bucket = value > 0 ? bucket : 0;
+
+            auto& count = m_counts[bucket];
+            m_size += count == 0;
+            count += count != std::numeric_limits<std::uint32_t>::max();
+            m_cursor_index = 0;
+            m_cursor_bucket = 0;
+        }
+
+        void merge(const histogram_metric& other) {
+            for (std::size_t bucket=0; bucket < buckets(); ++bucket) {
+                m_size += m_counts[bucket] == 0 && other.m_counts[bucket] != 0;
+                std::uint64_t count = m_counts[bucket] + std::uint64_t{other.m_counts[bucket]};
+                m_counts[bucket] = static_cast<std::uint32_t>(std::min<std::uint64_t>(count, std::numeric_limits<std::uint32_t>::max()));
+            }
+            m_cursor_index = 0;
+            m_cursor_bucket = 0;
+        }
+
+        /**
+         * Midpoint of the index-th non-empty bucket
+         */
+        type value_at(std::size_t index) const {
+            std::size_t bucket = find_bucket(index);
+            if (bucket == 0)
+                return 0;
+
+            std::size_t value_bucket = bucket - 1;
+            double mantissa = 1 + ((value_bucket & ((1 << precision) - 1)) + 0.5) / (1 << precision);
+            return std::ldexp(mantissa, static_cast<int>(value_bucket >> precision) + min_exponent);
+        }
+
+        std::size_t count_at(std::size_t index) const {
+            return m_counts[find_bucket(index)];
+        }
+
+        /**
+         * Number of non-empty buckets
+         */
+        constexpr std::size_t size() const {
+            return m_size;
+        }
+
+    private:
+        std::array<std::uint32_t, buckets()> m_counts{};
+        std::size_t m_size{0};
+
+        // The writer reads the buckets in order, so the last position found is where the next search starts
+        mutable std::size_t m_cursor_index{0};
+        mutable std::size_t m_cursor_bucket{0};
+
+        std::size_t find_bucket(std::size_t index) const {
+            if (index >= m_size)
+                throw std::out_of_range("histogram_metric::value_at");
+
+            if (index < m_cursor_index || m_counts[m_cursor_bucket] == 0) {
+                m_cursor_index = 0;
+                m_cursor_bucket = 0;
+                while (m_counts[m_cursor_bucket] == 0)
+                    ++m_cursor_bucket;
+            }
+
+            while (m_cursor_index < index) {
+                do {
+                    ++m_cursor_bucket;
+                } while (m_counts[m_cursor_bucket] == 0);
+                ++m_cursor_index;
+            }
+
+            return m_cursor_bucket;
+        }
     };
 
+    namespace internal {
+
+        /**
+         * Exact sum of integers in 128 bits, as two halves for the compilers without __int128
+         */
+        template<typename value_t>
+        class integral_sum {
+        public:
+            void add(value_t value) {
+                auto previous = m_low;
+                m_low += static_cast<std::uint64_t>(value);
+                m_high += std::int64_t{m_low < previous} - negative(value);
+            }
+
+            void subtract(value_t value) {
+                auto previous = m_low;
+                m_low -= static_cast<std::uint64_t>(value);
+                m_high -= std::int64_t{m_low > previous} - negative(value);
+            }
+
+            void add(const integral_sum& other) {
+                auto previous = m_low;
+                m_low += other.m_low;
+                m_high += other.m_high + std::int64_t{m_low < previous};
+            }
+
+            double value() const {
+                // Sums within int64_t are converted at once, -1 as the high half would cancel the low one
+                if ((m_high == 0 && m_low >> 63 == 0) || (m_high == -1 && m_low >> 63 == 1))
+                    return static_cast<double>(static_cast<std::int64_t>(m_low));
+                return std::ldexp(static_cast<double>(m_high), 64) + static_cast<double>(m_low);
+            }
+
+        private:
+            std::uint64_t m_low{0};
+            std::int64_t m_high{0};
+
+            static std::int64_t negative(value_t value) {
+                if constexpr(std::is_signed_v<value_t>)
+                    return value < 0;
+                else
+                    return 0;
+            }
+        };
+
+        /**
+         * Sum of floating point values with Neumaier's compensation, the rounding errors of the additions are summed
+         * separately and added at the end
+         */
+        class compensated_sum {
+        public:
+            void add(double value) {
+                double sum = m_sum + value;
+                // Once the sum is infinite or NaN, the compensation would only turn it into NaN
+                if (std::isfinite(sum))
+                    m_compensation += std::abs(m_sum) >= std::abs(value) ? (m_sum - sum) + value : (value - sum) + m_sum;
+                m_sum = sum;
+            }
+
+            void subtract(double value) {
+                add(-value);
+            }
+
+            void add(const compensated_sum& other) {
+                add(other.m_sum);
+                m_compensation += other.m_compensation;
+            }
+
+            double value() const {
+                return std::isfinite(m_sum) ? m_sum + m_compensation : m_sum;
+            }
+
+        private:
+            double m_sum{0};
+            double m_compensation{0};
+        };
+    }
+
+    /**
+     * Metric keeping only the count, sum, minimum and maximum of its values. It is written as Values and Counts that
+     * preserve all four: [min, mean of the other values, max] with counts [1, count - 2, 1]. Integers are summed
+     * exactly, floating point values with compensated summation, so the mean in between keeps its precision next to
+     * a large minimum or maximum.
+     */
+    template<internal::named metric_name, internal::unit_c auto metric_unit, typename value_type = double, typename... options_t>
+    class stat_metric {
+        static_assert(sizeof(value_type) <= sizeof(double), "stat_metric holds 8 byte values at most");
+
+        using precision_t = typename internal::find_option<internal::precision_tag, void, options_t...>::type;
+
+        using sum_t = std::conditional_t<std::is_integral_v<value_type>, internal::integral_sum<value_type>, internal::compensated_sum>;
+
+    public:
+        using type = value_type;
+
+        static constexpr std::string_view name() {
+            return metric_name.name();
+        }
+
+        static constexpr std::string_view unit_name() {
+            return internal::unit_name(internal::to_unit(metric_unit));
+        }
+
+        static constexpr internal::number_format format() {
+            if constexpr(std::is_void_v<precision_t>)
+                return internal::shortest_format;
+            else
+                return precision_t::number_format;
+        }
+
+        void put_value(type value) {
+            ++m_count;
+            m_sum.add(value);
+            m_min = std::min(m_min, value);
+            m_max = std::max(m_max, value);
+        }
+
+        void merge(const stat_metric& other) {
+            m_count += other.m_count;
+            m_sum.add(other.m_sum);
+            m_min = std::min(m_min, other.m_min);
+            m_max = std::max(m_max, other.m_max);
+        }
+
+        std::size_t count() const {
+            return m_count;
+        }
+
+        double sum() const {
+            return m_sum.value();
+        }
+
+        type min() const {
+            return m_min;
+        }
+
+        type max() const {
+            return m_max;
+        }
+
+        /**
+         * Values in ascending order, the minimum, the mean of the values between and the maximum
+         */
+        double value_at(std::size_t index) const {
+            if (index >= size())
+                throw std::out_of_range("stat_metric::value_at");
+
+            if (index == 0)
+                return m_min;
+            if (index == size() - 1)
+                return m_max;
+
+            // Subtracted before rounding, the values in between may be small next to the minimum and maximum
+            auto between = m_sum;
+            between.subtract(m_min);
+            between.subtract(m_max);
+            return between.value() / static_cast<double>(m_count - 2);
+        }
+
+        std::size_t count_at(std::size_t index) const {
+            if (index >= size())
+                throw std::out_of_range("stat_metric::count_at");
+
+            if (size() == 1)
+                return m_count;
+            if (index == 1 && size() == 3)
+                return m_count - 2;
+            return 1;
+        }
+
+        std::size_t size() const {
+            if (m_count == 0)
+                return 0;
+            if (m_count == 1 || m_min == m_max)
+                return 1;
+            return m_count == 2 ? 2 : 3;
+        }
+
+    private:
+        std::uint64_t m_count{0};
+        sum_t m_sum;
+        type m_min{std::numeric_limits<type>::max()};
+        type m_max{std::numeric_limits<type>::lowest()};
+    };
+
+    namespace internal {
+
+        /**
+         * Size of the cache lines that atomic metrics are padded to, so metrics updated from different threads
+         * never share one
+         */
+        constexpr std::size_t cache_line_size = 64;
+    }
+
+    /**
+     * Metric adding up its values with a relaxed atomic fetch_add, so it can be updated from many threads at once
+     * without a lock. It is written as a single value, the sum, also when nothing was added.
+     */
+    template<internal::named metric_name, internal::unit_c auto metric_unit, typename value_type = std::int64_t>
+    class alignas(internal::cache_line_size) counter_metric {
+    public:
+        using type = value_type;
+
+        static constexpr std::string_view name() {
+            return metric_name.name();
+        }
+
+        static constexpr std::string_view unit_name() {
+            return internal::unit_name(internal::to_unit(metric_unit));
+        }
+
+        counter_metric() = default;
+
+        counter_metric(const counter_metric& other): m_value{other.m_value.load(std::memory_order_relaxed)} {}
+
+        counter_metric& operator=(const counter_metric& other) {
+            m_value.store(other.m_value.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            return *this;
+        }
+
+        void put_value(type value) {
+            m_value.fetch_add(value, std::memory_order_relaxed);
+        }
+
+        void merge(const counter_metric& other) {
+            put_value(other.m_value.load(std::memory_order_relaxed));
+        }
+
+        type value_at(std::size_t index) const {
+            if (index >= size())
+                throw std::out_of_range("counter_metric::value_at");
+            return m_value.load(std::memory_order_relaxed);
+        }
+
+        constexpr std::size_t size() const {
+            return 1;
+        }
+
+    private:
+        std::atomic<type> m_value{0};
+    };
+
+    /**
+     * Metric keeping the last value put with an atomic store, so it can be updated from many threads at once without
+     * a lock. It is written as a single value once one was put.
+     */
+    template<internal::named metric_name, internal::unit_c auto metric_unit, typename value_type = double>
+    class alignas(internal::cache_line_size) gauge_metric {
+    public:
+        using type = value_type;
+
+        static constexpr std::string_view name() {
+            return metric_name.name();
+        }
+
+        static constexpr std::string_view unit_name() {
+            return internal::unit_name(internal::to_unit(metric_unit));
+        }
+
+        gauge_metric() = default;
+
+        gauge_metric(const gauge_metric& other) {
+            *this = other;
+        }
+
+        gauge_metric& operator=(const gauge_metric& other) {
+            m_value.store(other.m_value.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            m_set.store(other.m_set.load(std::memory_order_acquire), std::memory_order_release);
+            return *this;
+        }
+
+        void put_value(type value) {
+            m_value.store(value, std::memory_order_relaxed);
+            m_set.store(true, std::memory_order_release);
+        }
+
+        /**
+         * Takes the value of other if it has one, there is no order between the values of two gauges
+         */
+        void merge(const gauge_metric& other) {
+            if (other.size() != 0)
+                put_value(other.m_value.load(std::memory_order_relaxed));
+        }
+
+        type value_at(std::size_t index) const {
+            if (index >= size())
+                throw std::out_of_range("gauge_metric::value_at");
+            return m_value.load(std::memory_order_relaxed);
+        }
+
+        std::size_t size() const {
+            return m_set.load(std::memory_order_acquire);
+        }
+
+    private:
+        std::atomic<type> m_value{};
+        std::atomic<bool> m_set{false};
+    };
+
+    namespace internal {
+
+        /**
+         * Counts per integer key in a window of max_buckets consecutive keys. When a key does not fit, the window moves
+         * up and the lowest keys are collapsed into the lowest bucket of the new window.
+         */
+        template<std::size_t max_buckets>
+        class collapsing_store {
+            static_assert(max_buckets > 0);
+
+        public:
+            void add(int key, std::uint64_t count = 1) {
+                if (m_size == 0) {
+                    m_offset = key - static_cast<int>(max_buckets / 2);
+                    m_min_key = key;
+                    m_max_key = key;
+                } else if (key < m_offset) {
+                    move_window(std::max(key, m_max_key - static_cast<int>(max_buckets) + 1));
+                } else if (key >= m_offset + static_cast<int>(max_buckets)) {
+                    move_window(key - static_cast<int>(max_buckets) + 1);
+                }
+
+                key = std::max(key, m_offset);
+                m_min_key = std::min(m_min_key, key);
+                m_max_key = std::max(m_max_key, key);
+
+                auto& bucket = m_counts[key - m_offset];
+                m_size += bucket == 0;
+                bucket += count;
+                m_cursor_bucket = -1;
+            }
+
+            /**
+             * Number of non-empty buckets
+             */
+            std::size_t size() const {
+                return m_size;
+            }
+
+            /**
+             * Key and count of the index-th non-empty bucket, in ascending key order
+             */
+            int key_at(std::size_t index) const {
+                return find_bucket(index) + m_offset;
+            }
+
+            std::uint64_t count_at(std::size_t index) const {
+                return m_counts[find_bucket(index)];
+            }
+
+            void for_each(auto&& f) const {
+                if (m_size == 0)
+                    return;
+                for (int key=m_min_key; key <= m_max_key; ++key) {
+                    if (m_counts[key - m_offset] != 0)
+                        f(key, m_counts[key - m_offset]);
+                }
+            }
+
+        private:
+            std::array<std::uint64_t, max_buckets> m_counts{};
+            int m_offset{0};
+            int m_min_key{0};
+            int m_max_key{0};
+            std::size_t m_size{0};
+
+            // The writer reads the buckets in order, so searches start from the last bucket found
+            mutable std::size_t m_cursor_index{0};
+            mutable int m_cursor_bucket{-1};
+
+            void move_window(int offset) {
+                m_cursor_bucket = -1;
+                std::array<std::uint64_t, max_buckets> counts{};
+
+                for (int key=m_min_key; key <= m_max_key; ++key)
+                    counts[std::max(key, offset) - offset] += m_counts[key - m_offset];
+
+                m_counts = counts;
+                m_offset = offset;
+                m_min_key = std::max(m_min_key, offset);
+                m_max_key = std::max(m_max_key, offset);
+                m_size = max_buckets - std::count(m_counts.begin(), m_counts.end(), 0);
+            }
+
+            int find_bucket(std::size_t index) const {
+                if (index >= m_size)
+                    throw std::out_of_range("collapsing_store::count_at");
+
+                if (m_cursor_bucket < 0) {
+                    m_cursor_index = 0;
+                    m_cursor_bucket = m_min_key - m_offset;
+                }
+
+                while (m_cursor_index < index) {
+                    do {
+                        ++m_cursor_bucket;
+                    } while (m_counts[m_cursor_bucket] == 0);
+                    ++m_cursor_index;
+                }
+                while (m_cursor_index > index) {
+                    do {
+                        --m_cursor_bucket;
+                    } while (m_counts[m_cursor_bucket] == 0);
+                    --m_cursor_index;
+                }
+
+                return m_cursor_bucket;
+            }
+        };
+    }
+
+    /**
+     * Metric keeping a DDSketch of its values: every value is counted in a bucket of values within relative_accuracy
+     * of each other, buckets grow geometrically, so a wide range of values fits in a few hundred buckets. The metric
+     * is written as Values and Counts, each value within relative_accuracy of the values counted for it.
+     *
+     * Positive and negative values each keep at most max_buckets buckets, when a sketch needs more, the buckets of the
+     * values closest to zero are collapsed. Sketches of the same type can be merged. Infinities are counted in the
+     * bucket of the largest values, NaN as 0.
+     */
+    template<internal::named metric_name, internal::unit_c auto metric_unit, double relative_accuracy = 0.01,
+            std::size_t max_buckets = 512>
+    class sketch_metric {
+        static_assert(relative_accuracy > 0 && relative_accuracy < 1, "relative_accuracy is between 0 and 1");
+
+        static constexpr double gamma = (1 + relative_accuracy) / (1 - relative_accuracy);
+
+        // std::log is not constexpr: with gamma = m 2^e and m in [1, 2), ln(m) = 2 atanh((m - 1) / (m + 1))
+        static constexpr double log_gamma = [] {
+            double m = gamma;
+            int e = 0;
+            for (; m >= 2; m /= 2)
+                ++e;
+            double x = (m - 1) / (m + 1), square = x * x, term = x, sum = 0;
+            for (int n = 1; sum + term / n != sum; n += 2, term *= square)
+                sum += term / n;
+            return e * std::numbers::ln2 + 2 * sum;
+        }();
+
+        static_assert(1023 * std::numbers::ln2 / log_gamma < std::numeric_limits<int>::max() / 4,
+                      "relative_accuracy is too small for the keys to fit into int");
+
+        // The largest key whose value stays finite, larger values and infinity are counted with it
+        static constexpr int max_key = static_cast<int>(1023 * std::numbers::ln2 / log_gamma);
+
+        // Below this magnitude values are counted as 0, their keys would be below -max_key
+        static constexpr double min_value = 1e-300;
+
+    public:
+        using type = double;
+
+        static constexpr std::string_view name() {
+            return metric_name.name();
+        }
+
+        static constexpr std::string_view unit_name() {
+            return internal::unit_name(internal::to_unit(metric_unit));
+        }
+
+        void put_value(type value) {
+            if (value > min_value)
+                m_positive.add(key(value));
+            else if (value < -min_value)
+                m_negative.add(key(-value));
+            else
+                ++m_zero_count;
+        }
+
+        /**
+         * Adds the values counted by other, as if they had been put into this sketch
+         */
+        void merge(const sketch_metric& other) {
+            other.m_positive.for_each([this](int key, std::uint64_t count) { m_positive.add(key, count); });
+            other.m_negative.for_each([this](int key, std::uint64_t count) { m_negative.add(key, count); });
+            m_zero_count += other.m_zero_count;
+        }
+
+        /**
+         * Values are in ascending order, negative values first
+         */
+        type value_at(std::size_t index) const {
+            if (index < m_negative.size())
+                return -value(m_negative.key_at(m_negative.size() - 1 - index));
+            index -= m_negative.size();
+
+            if (m_zero_count != 0 && index-- == 0)
+                return 0;
+
+            return value(m_positive.key_at(index));
+        }
+
+        std::size_t count_at(std::size_t index) const {
+            if (index < m_negative.size())
+                return m_negative.count_at(m_negative.size() - 1 - index);
+            index -= m_negative.size();
+
+            if (m_zero_count != 0 && index-- == 0)
+                return m_zero_count;
+
+            return m_positive.count_at(index);
+        }
+
+        /**
+         * Number of non-empty buckets
+         */
+        std::size_t size() const {
+            return m_negative.size() + (m_zero_count != 0) + m_positive.size();
+        }
+
+    private:
+        internal::collapsing_store<max_buckets> m_positive;
+        internal::collapsing_store<max_buckets> m_negative;
+        std::uint64_t m_zero_count{0};
+
+        static int key(double value) {
+            return static_cast<int>(std::min(std::ceil(std::log(value) / log_gamma), double{max_key}));
+        }
+
+        /**
+         * The value within relative_accuracy of every value in the bucket of key
+         */
+        static double value(int key) {
+            return 2 * std::exp(key * log_gamma) / (gamma + 1);
+        }
+    };
+
+    namespace internal {
+
+        /**
+         * Writes the metrics header and values of each block, derived_t provides the storage through metric_at<index>(),
+         * which returns the metric or a view with its size() and value_at()
+         */
+        template<typename derived_t, emf_metric_c... metrics_t>
+        class metrics_writer {
+        public:
+            /**
+             * Most values of one metric in one message, unless the sink asks for fewer
+             */
+            static constexpr int block_size{100};
+
+            template<named name> void put_value_by_name(auto value) {
+                self().template put_value<index_by_name<name, metrics_t...>()>(value);
+            }
+
+            static constexpr int size() {
+                return sizeof...(metrics_t);
+            }
+
+            std::size_t max_array_value_size() const {
+                std::size_t max=0;
+                auto max_f = [&](auto&& m) {
+                    max = std::max(max, m.size());
+                };
+
+                [&]<std::size_t... index>(std::index_sequence<index...>) {
+                    (max_f(self().template metric_at<index>()), ...);
+                }(std::make_index_sequence<sizeof...(metrics_t)>{});
+
+                return max;
+            }
+
+            /**
+             * Index of the last block, every block is written as its own EMF message
+             */
+            int num_blocks(int values_per_block = block_size) const {
+                auto max = max_array_value_size();
+                return max == 0 ? 0 : static_cast<int>((max - 1) / values_per_block);
+            }
+
+            static constexpr bool bounded() {
+                return (emf_bounded_metric_c<metrics_t> && ...);
+            }
+
+            /**
+             * Most messages a logger with these metrics writes in one flush
+             */
+            static constexpr std::size_t max_messages() requires (bounded()) {
+                std::size_t max = std::max({std::size_t{0}, metrics_t::max_values()...});
+                return max == 0 ? 1 : (max - 1) / block_size + 1;
+            }
+
+            /**
+             * Upper bound of the bytes write_header and write_values add to one message with output_sink_string
+             */
+            static constexpr std::size_t max_size() requires (bounded()) {
+                if constexpr(size() == 0) {
+                    return 0;
+                } else {
+                    return []<std::size_t... index>(std::index_sequence<index...>) {
+                        // Metrics array, the metric headers with commas in between and the values
+                        return header_open_fragment.view().size() + 1 + (sizeof...(metrics_t) - 1)
+                            + ((header_fragment<index>.view().size() + max_value_size<index>()) + ...);
+                    }(std::make_index_sequence<sizeof...(metrics_t)>{});
+                }
+            }
+
+
+
+            void write_header(emf_msg_sink_c auto& sink, int block, int values_per_block = block_size) const {
+                if constexpr(size() > 0) {
+                    if constexpr(emf_fragment_sink_c<std::remove_cvref_t<decltype(sink)>>) {
+                        sink.write_fragment(header_open_fragment.view());
+                    } else {
+                        sink.write_next_element();
+
+                        sink.open_array("Metrics");
+                    }
+
+                    bool first{true};
+                    write_recursive_header(sink, block, values_per_block, first);
+
+                    sink.close_array();
+                }
+            }
+
+            void write_values(emf_msg_sink_c auto& sink, int block, int values_per_block = block_size) const {
+                if constexpr(size() > 0) {
+                    write_recursive_values(sink, block, values_per_block);
+                }
+            }
+
+        private:
+            derived_t& self() {
+                return static_cast<derived_t&>(*this);
+            }
+
+            const derived_t& self() const {
+                return static_cast<const derived_t&>(*this);
+            }
+
+            template<int index> using metric_t = std::tuple_element_t<index, std::tuple<metrics_t...>>;
+
+            static constexpr auto header_open_fragment = make_fragment<[] {
+                return std::string(",\"Metrics\": [");
+            }>();
+
+            template<int index> static constexpr auto header_fragment = make_fragment<[] {
+                return "{" + json_key("Name") + json_string(metric_t<index>::name()) + ","
+                    + json_key("Unit") + json_string(metric_t<index>::unit_name()) + "}";
+            }>();
+
+            template<int index> static constexpr auto value_fragment = make_fragment<[] {
+                return "," + json_key(metric_t<index>::name());
+            }>();
+
+            template<int index> static constexpr auto array_fragment = make_fragment<[] {
+                return "," + json_key(metric_t<index>::name()) + " [";
+            }>();
+
+            template<int index> static constexpr auto counted_fragment = make_fragment<[] {
+                return "," + json_key(metric_t<index>::name()) + " {" + json_key("Values") + " [";
+            }>();
+
+            static constexpr auto counts_fragment = make_fragment<[] {
+                return "]," + json_key("Counts") + " [";
+            }>();
+
+            /**
+             * Writes a value with the metric's number format, the default format uses the plain write_value
+             */
+            template<int index>
+            static void write_value(emf_msg_sink_c auto& sink, auto... name_value) {
+                constexpr number_format format = format_of<metric_t<index>>();
+
+                if constexpr(format.precision >= 0 && std::floating_point<typename metric_t<index>::type>)
+                    sink.write_value(name_value..., format);
+                else
+                    sink.write_value(name_value...);
+            }
+
+            template<int index>
+            static constexpr std::size_t max_value_size() {
+                using value_t = typename metric_t<index>::type;
+                constexpr std::size_t chars = max_chars<value_t>(std::floating_point<value_t> ? format_of<metric_t<index>>() : shortest_format);
+                constexpr std::size_t values = std::min<std::size_t>(metric_t<index>::max_values(), block_size);
+
+                return std::max(value_fragment<index>.view().size() + chars,
+                                array_fragment<index>.view().size() + values * (chars + 1));
+            }
+
+            static bool in_block(const auto& metric, int block, int values_per_block) {
+                return metric.size() > static_cast<std::size_t>(block) * values_per_block;
+            }
+
+            template<int index=0>
+            void write_recursive_header(emf_msg_sink_c auto& sink, int block, int values_per_block, bool& first) const {
+                const auto& metric = self().template metric_at<index>();
+
+                if (in_block(metric, block, values_per_block)) {
+                    if (!first)
+                        sink.write_next_element();
+                    first = false;
+
+                    if constexpr(emf_fragment_sink_c<std::remove_cvref_t<decltype(sink)>>) {
+                        sink.write_fragment(header_fragment<index>.view());
+                    } else {
+                        sink.open_object();
+
+                        sink.write_value("Name", metric_t<index>::name());
+                        sink.write_next_element();
+                        sink.write_value("Unit", metric_t<index>::unit_name());
+
+                        sink.close_object();
+                    }
+                }
+
+                if constexpr(index < sizeof...(metrics_t) - 1) {
+                    write_recursive_header<(index+1)>(sink, block, values_per_block, first);
+                }
+            }
+
+            template<int index=0>
+            void write_recursive_values(emf_msg_sink_c auto& sink, int block, int values_per_block) const {
+                constexpr bool fragments = emf_fragment_sink_c<std::remove_cvref_t<decltype(sink)>>;
+                const auto& metric = self().template metric_at<index>();
+
+                if constexpr(emf_counted_metric_c<std::remove_cvref_t<decltype(metric)>>) {
+                    if (in_block(metric, block, values_per_block))
+                        write_counted_values<index>(sink, metric, block, values_per_block);
+                } else if (metric.size() == 1 && block == 0) {
+                    if constexpr(fragments) {
+                        sink.write_fragment(value_fragment<index>.view());
+                        write_value<index>(sink, metric.value_at(0));
+                    } else {
+                        sink.write_next_element();
+                        write_value<index>(sink, metric_t<index>::name(), metric.value_at(0));
+                    }
+                } else if (metric.size() > 1 && in_block(metric, block, values_per_block)) {
+                    std::size_t start_index = block * values_per_block;
+                    std::size_t end_index = std::min<std::size_t>((block+1) * values_per_block, metric.size());
+
+                    if constexpr(fragments) {
+                        sink.write_fragment(array_fragment<index>.view());
+                    } else {
+                        sink.write_next_element();
+                        sink.open_array(metric_t<index>::name());
+                    }
+
+                    for (std::size_t i=start_index; i < end_index; ++i) {
+                        if (i != start_index)
+                            sink.write_next_element();
+                        write_value<index>(sink, metric.value_at(i));
+                    }
+
+                    sink.close_array();
+                }
+
+                if constexpr(index < sizeof...(metrics_t) - 1) {
+                    write_recursive_values<(index+1)>(sink, block, values_per_block);
+                }
+            }
+
+            template<int index>
+            static void write_counted_values(emf_msg_sink_c auto& sink, const auto& metric, int block, int values_per_block) {
+                std::size_t start_index = block * values_per_block;
+                std::size_t end_index = std::min<std::size_t>((block+1) * values_per_block, metric.size());
+
+                if constexpr(emf_fragment_sink_c<std::remove_cvref_t<decltype(sink)>>) {
+                    sink.write_fragment(counted_fragment<index>.view());
+                } else {
+                    sink.write_next_element();
+                    sink.open_object(metric_t<index>::name());
+                    sink.open_array("Values");
+                }
+
+                for (std::size_t i=start_index; i < end_index; ++i) {
+                    if (i != start_index)
+                        sink.write_next_element();
+                    write_value<index>(sink, metric.value_at(i));
+                }
+
+                if constexpr(emf_fragment_sink_c<std::remove_cvref_t<decltype(sink)>>) {
+                    sink.write_fragment(counts_fragment.view());
+                } else {
+                    sink.close_array();
+                    sink.write_next_element();
+                    sink.open_array("Counts");
+                }
+
+                for (std::size_t i=start_index; i < end_index; ++i) {
+                    if (i != start_index)
+                        sink.write_next_element();
+                    sink.write_value(metric.count_at(i));
+                }
+
+                sink.close_array();
+                sink.close_object();
+            }
+        };
+    }
+
     template<internal::emf_metric_c... metrics_t>
-    class metrics {
-        static constexpr int block_size{100};
-
+    class metrics: public internal::metrics_writer<metrics<metrics_t...>, metrics_t...> {
     public:
+        metrics() = default;
+
+        explicit metrics(std::pmr::memory_resource* resource): m_metrics{internal::make_with_resource<metrics_t>(resource)...} {}
+
         template<int index> void put_value(auto value) {
             std::get<index>(m_metrics).put_value(value);
         }
 
-        template<internal::named name> void put_value_by_name(auto&& value) {
-
-            std::apply([&](metrics_t&... m) -> void {
-
-                auto put_value_f = [&](auto&& m) {
-                    if (m.name() == name.name())
-                        m.put_value(value);
-                };
-
-                (put_value_f(m), ...);
-            }, m_metrics);
+        /**
+         * Merges each metric of other into the same metric of this
+         */
+        void merge(const metrics& other) requires (internal::emf_mergeable_metric_c<metrics_t> && ...) {
+            [&]<std::size_t... index>(std::index_sequence<index...>) {
+                (std::get<index>(m_metrics).merge(std::get<index>(other.m_metrics)), ...);
+            }(std::make_index_sequence<sizeof...(metrics_t)>{});
         }
 
-        static constexpr int size() {
-            return sizeof...(metrics_t);
+        template<int index> const auto& metric_at() const {
+            return std::get<index>(m_metrics);
         }
 
-        std::size_t max_array_value_size() const {
-            std::size_t max=0;
-            auto max_f = [&](auto&& m) {
-                max = std::max(max, m.size());
-            };
-
-            std::apply([&](const metrics_t&... m) -> void {
-                (max_f(m), ...);
-            }, m_metrics);
-
-            return max;
-        }
+    private:
+        std::tuple<metrics_t...> m_metrics;
+    };
 
-        int num_blocks() const {
-            return max_array_value_size() / block_size;
-        }
+    namespace internal {
 
+        /**
+         * A bounded metric of trivially copyable values, which packed_metrics can store
+         */
+        template<typename M> concept emf_packable_metric_c = emf_bounded_metric_c<M> && std::is_trivially_copyable_v<typename M::type> && requires {
+            { M::overflow_policy() } -> std::same_as<overflow>;
+        };
+    }
 
+    /**
+     * Alternative to metrics for bounded metrics. The values of all metrics share one buffer at compile time offsets,
+     * and their counts are packed into one array, so puts and flushes stay within a few cache lines.
+     */
+    template<internal::emf_packable_metric_c... metrics_t>
+    class packed_metrics: public internal::metrics_writer<packed_metrics<metrics_t...>, metrics_t...> {
+
+        template<int index> using metric_t = std::tuple_element_t<index, std::tuple<metrics_t...>>;
+
+        /**
+         * Byte offset of each metric's values, aligned for its value type, followed by the total size
+         */
+        static constexpr auto offsets = [] {
+            std::array<std::size_t, sizeof...(metrics_t) + 1> result{};
+            std::size_t offset{0};
+            std::size_t index{0};
+
+            auto add = [&](std::size_t alignment, std::size_t size) {
+                offset = (offset + alignment - 1) / alignment * alignment;
+                result[index++] = offset;
+                offset += size;
+            };
+            (add(alignof(typename metrics_t::type), metrics_t::max_values() * sizeof(typename metrics_t::type)), ...);
+            result[index] = offset;
 
-        void write_header(internal::emf_msg_sink_c auto& sink, int block) const {
-            if constexpr(size() > 0) {
-                sink.write_next_element();
+            return result;
+        }();
 
-                sink.open_array("Metrics");
+        static constexpr std::size_t alignment = std::max({std::size_t{1}, alignof(typename metrics_t::type)...});
 
-                write_recursive_header(sink, block);
+    public:
+        /**
+         * Values of one metric, in the order they were put
+         */
+        template<int index> class view {
+        public:
+            using type = typename metric_t<index>::type;
 
-                sink.close_array();
-            }
-        }
+            explicit view(const packed_metrics& metrics): m_metrics{metrics} {}
 
-        void write_values(internal::emf_msg_sink_c auto& sink, int block) const {
-            if constexpr(size() > 0) {
-                write_recursive_values(sink, block);
+            std::size_t size() const {
+                return std::min<std::size_t>(m_metrics.m_counts[index], capacity);
             }
-        }
-
-    private:
-        std::tuple<metrics_t...> m_metrics;
 
-        template<int index=0>
-        void write_recursive_header(internal::emf_msg_sink_c auto& sink, int block) const {
-            const auto& metric = std::get<index>(m_metrics);
+            type value_at(std::size_t value_index) const {
+                if (value_index >= size())
+                    throw std::out_of_range("packed_metrics::view::value_at");
 
-            if (metric.size() == 1 && block == 0) {
-                if (index != 0)
-                    sink.write_next_element();
+                std::size_t count = m_metrics.m_counts[index];
+                if (metric_t<index>::overflow_policy() == overflow::overwrite_oldest && count > capacity)
+                    value_index = (count + value_index) % capacity;
 
-                sink.open_object();
+                return m_metrics.template load<index>(value_index);
+            }
 
-                sink.write_value("Name", metric.name());
-                sink.write_next_element();
-                sink.write_value("Unit", metric.unit_name());
+            /**
+             * Number of values dropped with overflow::count
+             */
+            std::size_t overflows() const {
+                if constexpr(metric_t<index>::overflow_policy() == overflow::count)
+                    return m_metrics.m_counts[index] - size();
+                else
+                    return 0;
+            }
 
-                sink.close_object();
-            } else if (metric.size() > 1) {
-                std::size_t start_index = block * block_size;
+        private:
+            static constexpr std::size_t capacity = metric_t<index>::max_values();
 
-                if (metric.size() > start_index) {
-                    if (index != 0)
-                        sink.write_next_element();
+            const packed_metrics& m_metrics;
+        };
 
-                    sink.open_object();
+        packed_metrics() = default;
 
-                    sink.write_value("Name", metric.name());
-                    sink.write_next_element();
-                    sink.write_value("Unit", metric.unit_name());
+        explicit packed_metrics(std::pmr::memory_resource*) {}
 
-                    sink.close_object();
+        template<int index> void put_value(auto value) {
+            constexpr std::size_t capacity = metric_t<index>::max_values();
+            auto& count = m_counts[index];
+
+            if constexpr(metric_t<index>::overflow_policy() == overflow::overwrite_oldest) {
+                // count stays below twice the capacity, past the capacity count % capacity is the oldest value
+                store<index>(count % capacity, value);
+                if (++count == 2 * capacity)
+                    count = capacity;
+            } else {
+                if (count >= capacity) {
+                    if constexpr(metric_t<index>::overflow_policy() == overflow::count)
+                        count += count != std::numeric_limits<std::uint32_t>::max();
+                    return;
                 }
-            }
-
-            if constexpr(index < sizeof...(metrics_t) - 1) {
-                write_recursive_header<(index+1)>(sink, block);
+                store<index>(count++, value);
             }
         }
 
-        template<int index=0>
-        void write_recursive_values(internal::emf_msg_sink_c auto& sink, int block) const {
-            const auto& metric = std::get<index>(m_metrics);
+        /**
+         * Puts the values of each metric of other, oldest first, and adds their overflows
+         */
+        void merge(const packed_metrics& other) {
+            [&]<std::size_t... index>(std::index_sequence<index...>) {
+                (merge_metric<index>(other), ...);
+            }(std::make_index_sequence<sizeof...(metrics_t)>{});
+        }
 
-            if (metric.size() == 1 && block == 0) {
-                sink.write_next_element();
-                sink.write_value(metric.name(), metric.value_at(0));
-            } else if (metric.size() > 1) {
-                std::size_t start_index = block * block_size;
+        template<int index> view<index> metric_at() const {
+            return view<index>(*this);
+        }
 
-                if (metric.size() > start_index) {
-                    std::size_t end_index = (block+1) * block_size;
-                    if (metric.size() < end_index)
-                        end_index = metric.size();
+    private:
+        alignas(alignment) std::array<std::byte, offsets.back()> m_values;
+        std::array<std::uint32_t, sizeof...(metrics_t)> m_counts{};
 
-                    sink.write_next_element();
-                    sink.open_array(metric.name());
+        template<int index> void merge_metric(const packed_metrics& other) {
+            auto metric = other.metric_at<index>();
+            for (std::size_t i=0; i < metric.size(); ++i)
+                put_value<index>(metric.value_at(i));
 
-                    for (int i=start_index; i < end_index; ++i) {
-                        if (i != start_index)
-                            sink.write_next_element();
-                        sink.write_value(metric.value_at(i));
-                    }
+            std::uint64_t count = m_counts[index] + std::uint64_t{metric.overflows()};
+            m_counts[index] = static_cast<std::uint32_t>(std::min<std::uint64_t>(count, std::numeric_limits<std::uint32_t>::max()));
+        }
 
-                    sink.close_array();
-                }
-            }
+        template<int index> void store(std::size_t value_index, typename metric_t<index>::type value) {
+            std::memcpy(m_values.data() + offsets[index] + value_index * sizeof(value), &value, sizeof(value));
+        }
 
-            if constexpr(index < sizeof...(metrics_t) - 1) {
-                write_recursive_values<(index+1)>(sink, block);
-            }
+        template<int index> typename metric_t<index>::type load(std::size_t value_index) const {
+            typename metric_t<index>::type value;
+            std::memcpy(&value, m_values.data() + offsets[index] + value_index * sizeof(value), sizeof(value));
+            return value;
         }
     };
 
@@ -276,12 +2048,15 @@ namespace cw_emf {
     template<internal::named dimension_name>
     class dimension {
     public:
+        dimension() = default;
+
+        explicit dimension(std::pmr::memory_resource* resource): m_value{resource} {}
 
-        std::string_view name() const {
+        static constexpr std::string_view name() {
             return dimension_name.name();
         }
 
-        void value(const std::string& value) {
+        void value(std::string_view value) {
             m_value = value;
         }
 
@@ -290,20 +2065,20 @@ namespace cw_emf {
         }
 
     private:
-        std::string m_value;
+        std::pmr::string m_value;
     };
 
     template<internal::named dimension_name, internal::named dimension_value>
     class dimension_fixed {
     public:
 
-        std::string_view name() const {
+        static constexpr std::string_view name() {
             return dimension_name.name();
         }
 
-        void value(const std::string& value) {}
+        void value(std::string_view) {}
 
-        std::string_view value() const {
+        static constexpr std::string_view value() {
             return dimension_value.name();
         }
     };
@@ -313,26 +2088,39 @@ namespace cw_emf {
     public:
         static_assert(sizeof...(dimensions_t) < 10, "AWS CloudWatch allows a maximum of 9 dimensions_t");
 
-        template<int index> void value(const std::string& value) {
+        dimensions() = default;
+
+        explicit dimensions([[maybe_unused]] std::pmr::memory_resource* resource): m_dimensions{internal::make_with_resource<dimensions_t>(resource)...} {}
+
+        template<int index> void value(std::string_view value) {
             std::get<index>(m_dimensions).value(value);
         }
 
-        template<internal::named name> void value_by_name(const std::string& value) {
-            std::apply([&](dimensions_t&... all_dimensions) {
-
-                auto value_f = [&](auto&& dimension) -> void {
-                    if (dimension.name() == name.name())
-                        dimension.value(value);
-                };
-                (value_f(all_dimensions), ...);
-            }, m_dimensions);
+        template<internal::named name> void value_by_name(std::string_view value) {
+            this->template value<internal::index_by_name<name, dimensions_t...>()>(value);
         }
 
         static constexpr int size() {
             return sizeof...(dimensions_t);
         }
 
+        /**
+         * Upper bound of the bytes write_header and write_values add to one message with output_sink_string,
+         * when no dimension value is longer than max_value_size bytes
+         */
+        static constexpr std::size_t max_size(std::size_t max_value_size) {
+            return header_fragment.view().size() + []<std::size_t... index>(std::index_sequence<index...>, std::size_t max_value_size) {
+                return (std::size_t{0} + ... + (1 + value_fragment<index>.view().size()
+                    + (internal::emf_static_dimension_c<dimension_t<index>> ? 0 : internal::max_json_string_size(max_value_size))));
+            }(std::make_index_sequence<sizeof...(dimensions_t)>{}, max_value_size);
+        }
+
         void write_header(internal::emf_msg_sink_c auto& sink) const {
+            if constexpr(internal::emf_fragment_sink_c<std::remove_cvref_t<decltype(sink)>>) {
+                sink.write_fragment(header_fragment.view());
+                return;
+            }
+
             sink.write_next_element();
 
             sink.open_array("Dimensions");
@@ -357,6 +2145,22 @@ namespace cw_emf {
     private:
         std::tuple<dimensions_t...> m_dimensions;
 
+        template<int index> using dimension_t = std::tuple_element_t<index, std::tuple<dimensions_t...>>;
+
+        static constexpr auto header_fragment = internal::make_fragment<[] {
+            std::string names;
+            ((names += (names.empty() ? "" : ",") + internal::json_string(dimensions_t::name())), ...);
+
+            return "," + internal::json_key("Dimensions") + " [[" + names + "]]";
+        }>();
+
+        template<int index> static constexpr auto value_fragment = internal::make_fragment<[] {
+            if constexpr(internal::emf_static_dimension_c<dimension_t<index>>)
+                return internal::json_key(dimension_t<index>::name()) + internal::json_string(dimension_t<index>::value());
+            else
+                return internal::json_key(dimension_t<index>::name());
+        }>();
+
         template<int index=0> void write_recursive_header(auto& sink) const {
             sink.write_value(std::get<index>(m_dimensions).name());
 
@@ -369,7 +2173,14 @@ namespace cw_emf {
         template<int index=0>
         void write_recursive_values(auto& sink) const {
             const auto& dimension = std::get<index>(m_dimensions);
-            sink.write_value(dimension.name(), dimension.value());
+
+            if constexpr(internal::emf_fragment_sink_c<std::remove_cvref_t<decltype(sink)>>) {
+                sink.write_fragment(value_fragment<index>.view());
+                if constexpr(!internal::emf_static_dimension_c<dimension_t<index>>)
+                    sink.write_value(dimension.value());
+            } else {
+                sink.write_value(dimension.name(), dimension.value());
+            }
 
             if constexpr(index < sizeof...(dimensions_t) - 1) {
                 sink.write_next_element();
@@ -385,12 +2196,15 @@ namespace cw_emf {
     template<internal::named message_name>
     class log_message {
     public:
+        log_message() = default;
 
-        std::string_view name() const {
+        explicit log_message(std::pmr::memory_resource* resource): m_value{resource} {}
+
+        static constexpr std::string_view name() {
             return message_name.name();
         }
 
-        void value(const std::string& value) {
+        void value(std::string_view value) {
             m_value = value;
         }
 
@@ -399,31 +2213,38 @@ namespace cw_emf {
         }
 
     private:
-        std::string m_value;
+        std::pmr::string m_value;
     };
 
     template<internal::emf_log_message_c... log_t>
     class log_messages {
     public:
-        template<int index> void value(const std::string& value) {
+        log_messages() = default;
+
+        explicit log_messages([[maybe_unused]] std::pmr::memory_resource* resource): m_logs{internal::make_with_resource<log_t>(resource)...} {}
+
+        template<int index> void value(std::string_view value) {
             std::get<index>(m_logs).value(value);
         }
 
-        template<internal::named name> void value_by_name(const std::string& value) {
-            std::apply([&](log_t&... all_logs) {
-
-                auto value_f = [&](auto&& log) -> void {
-                    if (log.name() == name.name())
-                        log.value(value);
-                };
-                (value_f(all_logs), ...);
-            }, m_logs);
+        template<internal::named name> void value_by_name(std::string_view value) {
+            this->template value<internal::index_by_name<name, log_t...>()>(value);
         }
 
         static constexpr int size() {
             return sizeof...(log_t);
         }
 
+        /**
+         * Upper bound of the bytes write_values adds to one message with output_sink_string,
+         * when no log value is longer than max_value_size bytes
+         */
+        static constexpr std::size_t max_size(std::size_t max_value_size) {
+            return []<std::size_t... index>(std::index_sequence<index...>, std::size_t max_value_size) {
+                return (std::size_t{0} + ... + (1 + value_fragment<index>.view().size() + internal::max_json_string_size(max_value_size)));
+            }(std::make_index_sequence<sizeof...(log_t)>{}, max_value_size);
+        }
+
         void write_values(internal::emf_msg_sink_c auto& sink) const {
             if constexpr(sizeof...(log_t) > 0) {
                 sink.write_next_element();
@@ -435,10 +2256,20 @@ namespace cw_emf {
     private:
         std::tuple<log_t...> m_logs;
 
+        template<int index> static constexpr auto value_fragment = internal::make_fragment<[] {
+            return internal::json_key(std::tuple_element_t<index, std::tuple<log_t...>>::name());
+        }>();
+
         template<int index=0>
         void write_recursive_values(auto& sink) const {
             const auto& log = std::get<index>(m_logs);
-            sink.write_value(log.name(), log.value());
+
+            if constexpr(internal::emf_fragment_sink_c<std::remove_cvref_t<decltype(sink)>>) {
+                sink.write_fragment(value_fragment<index>.view());
+                sink.write_value(log.value());
+            } else {
+                sink.write_value(log.name(), log.value());
+            }
 
             if constexpr(index < sizeof...(log_t) - 1) {
                 sink.write_next_element();
@@ -453,9 +2284,16 @@ namespace cw_emf {
      * Sink Classes
      */
 
-    class output_sink_string {
+    /**
+     * Writes the EMF messages into a string owned by the caller
+     */
+    template<typename string_t>
+    class basic_output_sink_string {
     public:
-        output_sink_string(std::string& out_buffer): m_buffer{out_buffer} {}
+        /**
+         * With validate_utf8 set, malformed UTF-8 in dimension and log values is replaced by U+FFFD
+         */
+        basic_output_sink_string(string_t& out_buffer, bool validate_utf8 = false): m_buffer{out_buffer}, m_validate_utf8{validate_utf8} {}
 
         void open_root_object() {
             open_object();
@@ -468,10 +2306,8 @@ namespace cw_emf {
             m_buffer += '{';
         }
         void open_object(std::string_view name) {
-            m_buffer += '"';
-            m_buffer += name.data();
-            m_buffer += "\": {";
-
+            write_key(name);
+            m_buffer += " {";
         }
         void close_object() {
             m_buffer += '}';
@@ -481,9 +2317,8 @@ namespace cw_emf {
             m_buffer += '[';
         }
         void open_array(std::string_view name) {
-            m_buffer += '"';
-            m_buffer += name.data();
-            m_buffer += "\": [";
+            write_key(name);
+            m_buffer += " [";
         }
         void close_array() {
             m_buffer += ']';
@@ -494,45 +2329,35 @@ namespace cw_emf {
         }
 
         void write_value(std::string_view name, const std::string& value) {
-            m_buffer += '"';
-            m_buffer += name.data();
-            m_buffer += "\":";
+            write_key(name);
             write_value(value);
         }
         void write_value(std::string_view name, std::string_view value) {
-            m_buffer += '"';
-            m_buffer += name.data();
-            m_buffer += "\":";
+            write_key(name);
             write_value(value);
         }
         void write_value(std::string_view name, bool value) {
-            m_buffer += '"';
-            m_buffer += name.data();
-            m_buffer += "\":";
+            write_key(name);
             write_value(value);
         }
         void write_value(std::string_view name, std::integral auto value) {
-            m_buffer += '"';
-            m_buffer += name.data();
-            m_buffer += "\":";
+            write_key(name);
             write_value(value);
         }
         void write_value(std::string_view name, std::floating_point auto value) {
-            m_buffer += '"';
-            m_buffer += name.data();
-            m_buffer += "\":";
+            write_key(name);
             write_value(value);
         }
+        void write_value(std::string_view name, std::floating_point auto value, internal::number_format format) {
+            write_key(name);
+            write_value(value, format);
+        }
 
         void write_value(const std::string& value) {
-            m_buffer += '"';
-            m_buffer += value;
-            m_buffer += '"';
+            internal::write_json_string(m_buffer, value, m_validate_utf8);
         }
         void write_value(std::string_view value) {
-            m_buffer += '"';
-            m_buffer += value.data();
-            m_buffer += '"';
+            internal::write_json_string(m_buffer, value, m_validate_utf8);
         }
         void write_value(bool value) {
             if (value)
@@ -541,10 +2366,25 @@ namespace cw_emf {
                 m_buffer += "false";
         }
         void write_value(std::integral auto value) {
-            m_buffer += std::to_string(value);
+            write_number(value, internal::max_chars<decltype(value)>());
         }
         void write_value(std::floating_point auto value) {
-            m_buffer += std::to_string(value);
+            write_number(value, internal::max_chars<decltype(value)>());
+        }
+        void write_value(std::floating_point auto value, internal::number_format format) {
+            write_number(value, internal::max_chars<decltype(value)>(format), format.format, format.precision);
+        }
+
+        void write_fragment(std::string_view fragment) {
+            m_buffer += fragment;
+        }
+
+        std::size_t size() const {
+            return m_buffer.size();
+        }
+
+        void truncate(std::size_t size) {
+            m_buffer.resize(size);
         }
 
         void done() {}
@@ -554,19 +2394,53 @@ namespace cw_emf {
         }
 
     private:
-        std::string& m_buffer;
+        string_t& m_buffer;
+        bool m_validate_utf8;
+
+        /**
+         * Names are escaped like values, they are rarely long enough for that to cost anything
+         */
+        void write_key(std::string_view name) {
+            internal::write_json_string(m_buffer, name);
+            m_buffer += ':';
+        }
+
+        /**
+         * Formats into a stack buffer and appends what was written, max_chars is an upper bound of the formatted size
+         * for the rare values that do not fit, like huge numbers in fixed format
+         */
+        void write_number(auto value, std::size_t max_chars, auto... format) {
+            char formatted[64];
+            auto [end, error] = std::to_chars(formatted, formatted + sizeof(formatted), value, format...);
+            if (error == std::errc()) {
+                m_buffer.append(formatted, end - formatted);
+                return;
+            }
+
+            auto size = m_buffer.size();
+            m_buffer.resize(size + max_chars);
+
+            auto result = std::to_chars(m_buffer.data() + size, m_buffer.data() + m_buffer.size(), value, format...);
+            m_buffer.resize(result.ptr - m_buffer.data());
+        }
     };
 
-    class output_sink_stdout: public output_sink_string {
+    using output_sink_string = basic_output_sink_string<std::string>;
+    using output_sink_pmr_string = basic_output_sink_string<std::pmr::string>;
+
+    class output_sink_stdout: public output_sink_pmr_string {
     public:
-        output_sink_stdout(): output_sink_string(m_buffer) {}
+        output_sink_stdout(bool validate_utf8 = false, std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+            : output_sink_pmr_string(m_buffer, validate_utf8), m_buffer{resource} {}
+
+        explicit output_sink_stdout(std::pmr::memory_resource* resource): output_sink_stdout(false, resource) {}
 
         void done() {
             std::fputs(m_buffer.c_str(), stdout);
             std::fflush(stdout);
         }
     private:
-        std::string m_buffer;
+        std::pmr::string m_buffer;
     };
 
     class output_sink_null {
@@ -588,12 +2462,16 @@ namespace cw_emf {
         void write_value(std::string_view, bool) const {}
         void write_value(std::string_view, std::integral auto) const {}
         void write_value(std::string_view, std::floating_point auto) const {}
+        void write_value(std::string_view, std::floating_point auto, internal::number_format) const {}
 
         void write_value(const std::string&) const {}
         void write_value(std::string_view) const {}
         void write_value(bool) const {}
         void write_value(std::integral auto) const {}
         void write_value(std::floating_point auto) const {}
+        void write_value(std::floating_point auto, internal::number_format) const {}
+
+        void write_fragment(std::string_view) const {}
 
         void done() {}
 
@@ -603,11 +2481,240 @@ namespace cw_emf {
 
     };
 
+    /**
+     * What async_writer::push does with a message that does not fit into the ring
+     */
+    enum class async_policy {
+        block,          // wait until the writer thread made room
+        drop_newest,    // drop the new message
+        drop_oldest     // drop the oldest messages not yet taken by the writer thread until the new one fits
+    };
+
+    /**
+     * Ring buffer of messages with a writer thread that hands them on, by default to stdout. Pushing a message copies
+     * it into the ring, the writer thread takes all messages in the ring at once and writes them with one call.
+     *
+     * The ring has a single producer: all loggers pushing to one async_writer must run on the same thread, use one
+     * async_writer per thread otherwise.
+     */
+    class async_writer {
+    public:
+        using write_function = std::function<void(std::string_view)>;
+
+        /**
+         * The ring holds capacity bytes, rounded up to a power of two, including 4 bytes per message
+         */
+        explicit async_writer(std::size_t capacity = 1 << 20, async_policy policy = async_policy::block,
+                              write_function write = write_stdout)
+            : m_ring(std::bit_ceil(std::max<std::size_t>(capacity, 64))), m_policy{policy}, m_write{std::move(write)},
+              m_thread([this] { run(); }) {}
+
+        async_writer(const async_writer&) = delete;
+        async_writer& operator=(const async_writer&) = delete;
+
+        ~async_writer() {
+            drain();
+            m_stop.store(true, std::memory_order_relaxed);
+            signal();
+            m_thread.join();
+        }
+
+        /**
+         * Copies message into the ring, or drops it as the policy says when the ring is full. Messages larger than
+         * the ring are always dropped.
+         */
+        void push(std::string_view message) {
+            std::uint64_t size = header_size + message.size();
+            std::uint64_t tail = m_tail.load(std::memory_order_relaxed);
+
+            if (size > m_ring.size()) {
+                m_dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+
+            while (true) {
+                // Head first: once the writer thread's claim moved it, the claim itself is visible as well
+                std::uint64_t head = m_head.load(std::memory_order_acquire);
+                std::uint64_t claimed = m_claimed.load(std::memory_order_acquire);
+                std::uint64_t used_from = claimed == no_claim ? head : claimed;
+                if (tail + size - used_from <= m_ring.size())
+                    break;
+
+                bool fits_after_claim = tail + size - head <= m_ring.size();
+                switch (m_policy) {
+                    case async_policy::block:
+                        if (claimed != no_claim)
+                            m_claimed.wait(claimed, std::memory_order_acquire);
+                        else
+                            m_head.wait(head, std::memory_order_acquire);
+                        break;
+                    case async_policy::drop_newest:
+                        m_dropped.fetch_add(1, std::memory_order_relaxed);
+                        return;
+                    case async_policy::drop_oldest:
+                        // Claimed messages are being copied out and can be neither dropped nor overwritten
+                        if (claimed != no_claim && (fits_after_claim || head == tail)) {
+                            m_claimed.wait(claimed, std::memory_order_acquire);
+                            break;
+                        }
+                        // Only this thread writes the ring, so the header at head stays valid while it is read
+                        if (m_head.compare_exchange_strong(head, head + header_size + message_size(head), std::memory_order_acq_rel))
+                            m_dropped.fetch_add(1, std::memory_order_relaxed);
+                        break;
+                }
+            }
+
+            auto length = static_cast<std::uint32_t>(message.size());
+            copy_in(tail, &length, header_size);
+            copy_in(tail + header_size, message.data(), message.size());
+            m_tail.store(tail + size, std::memory_order_release);
+            signal();
+        }
+
+        /**
+         * Waits until every message pushed so far has been written or dropped
+         */
+        void drain() {
+            std::uint64_t tail = m_tail.load(std::memory_order_relaxed);
+            for (std::uint64_t written = m_written.load(std::memory_order_acquire); written < tail;
+                 written = m_written.load(std::memory_order_acquire)) {
+                m_written.wait(written, std::memory_order_acquire);
+            }
+        }
+
+        /**
+         * Number of messages dropped because the ring was full or they were larger than the ring
+         */
+        std::size_t dropped() const {
+            return m_dropped.load(std::memory_order_relaxed);
+        }
+
+        static void write_stdout(std::string_view messages) {
+            std::fwrite(messages.data(), 1, messages.size(), stdout);
+            std::fflush(stdout);
+        }
+
+    private:
+        static constexpr std::size_t header_size = sizeof(std::uint32_t);
+        static constexpr std::uint64_t no_claim = std::numeric_limits<std::uint64_t>::max();
+
+        std::vector<char> m_ring;
+        async_policy m_policy;
+        write_function m_write;
+
+        alignas(internal::cache_line_size) std::atomic<std::uint64_t> m_head{0};     // oldest message not taken by the writer thread
+        std::atomic<std::uint64_t> m_claimed{no_claim};                              // start of the messages it is copying out
+        alignas(internal::cache_line_size) std::atomic<std::uint64_t> m_tail{0};
+        alignas(internal::cache_line_size) std::atomic<std::uint64_t> m_written{0};
+        std::atomic<std::uint64_t> m_signal{0};
+        std::atomic<std::size_t> m_dropped{0};
+        std::atomic<bool> m_stop{false};
+
+        std::thread m_thread;
+
+        void signal() {
+            m_signal.fetch_add(1, std::memory_order_release);
+            m_signal.notify_one();
+        }
+
+        void copy_in(std::uint64_t position, const void* data, std::size_t size) {
+            std::size_t offset = position & (m_ring.size() - 1);
+            std::size_t first = std::min(size, m_ring.size() - offset);
+            std::memcpy(m_ring.data() + offset, data, first);
+            std::memcpy(m_ring.data(), static_cast<const char*>(data) + first, size - first);
+        }
+
+        void copy_out(std::uint64_t position, void* data, std::size_t size) const {
+            std::size_t offset = position & (m_ring.size() - 1);
+            std::size_t first = std::min(size, m_ring.size() - offset);
+            std::memcpy(data, m_ring.data() + offset, first);
+            std::memcpy(static_cast<char*>(data) + first, m_ring.data(), size - first);
+        }
+
+        void release_claim() {
+            m_claimed.store(no_claim, std::memory_order_release);
+            m_claimed.notify_all();
+        }
+
+        std::uint32_t message_size(std::uint64_t position) const {
+            std::uint32_t size;
+            copy_out(position, &size, header_size);
+            return size;
+        }
+
+        void run() {
+            std::string messages;
+
+            while (true) {
+                std::uint64_t signal = m_signal.load(std::memory_order_acquire);
+                std::uint64_t head = m_head.load(std::memory_order_acquire);
+                std::uint64_t tail = m_tail.load(std::memory_order_acquire);
+
+                if (head == tail) {
+                    if (m_stop.load(std::memory_order_relaxed))
+                        return;
+                    m_written.store(head, std::memory_order_release);
+                    m_written.notify_all();
+                    m_signal.wait(signal, std::memory_order_acquire);
+                    continue;
+                }
+
+                // Claims the messages before copying them out, the producer then neither drops nor overwrites them.
+                // The claim fails when the producer dropped the message at head meanwhile.
+                m_claimed.store(head, std::memory_order_relaxed);
+                if (!m_head.compare_exchange_strong(head, tail, std::memory_order_acq_rel)) {
+                    release_claim();
+                    continue;
+                }
+                m_head.notify_all();
+
+                messages.clear();
+                for (std::uint64_t position = head; position != tail; ) {
+                    std::uint32_t size = message_size(position);
+                    std::size_t offset = messages.size();
+                    messages.resize(offset + size);
+                    copy_out(position + header_size, messages.data() + offset, size);
+                    position += header_size + size;
+                }
+                release_claim();
+
+                m_write(messages);
+
+                m_written.store(tail, std::memory_order_release);
+                m_written.notify_all();
+            }
+        }
+    };
+
+    /**
+     * Sink handing its messages to an async_writer, the logger only pays for copying them into the writer's ring
+     */
+    class output_sink_async: public output_sink_pmr_string {
+    public:
+        output_sink_async(async_writer& writer, bool validate_utf8 = false, std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+            : output_sink_pmr_string(m_buffer, validate_utf8), m_writer{writer}, m_buffer{resource} {}
+
+        output_sink_async(async_writer& writer, std::pmr::memory_resource* resource): output_sink_async(writer, false, resource) {}
+
+        void done() {
+            m_writer.push(m_buffer);
+            m_buffer.clear();
+        }
+
+    private:
+        async_writer& m_writer;
+        std::pmr::string m_buffer;
+    };
+
 
     /************************************************
      * Logger Class
      */
 
+    template<internal::named emf_namespace, typename metrics, typename dimensions, typename logs,
+            internal::emf_msg_sink_c sink_t, std::size_t shards>
+    class sharded_logger;
+
     template<internal::named emf_namespace,
             typename metrics,
             typename dimensions = dimensions<>,
@@ -615,8 +2722,20 @@ namespace cw_emf {
             internal::emf_msg_sink_c sink_t=output_sink_stdout>
     class logger {
 
+        template<internal::named, typename, typename, typename, internal::emf_msg_sink_c, std::size_t>
+        friend class sharded_logger;
+
     public:
-        logger(auto&&... args): m_sink(args...) {}
+        logger(auto&&... args) requires (!(std::same_as<std::remove_cvref_t<decltype(args)>, std::allocator_arg_t> || ...))
+            : m_sink(args...) {}
+
+        /**
+         * Metric values, dimension and log values and, if the sink takes a std::pmr::memory_resource* as its last
+         * constructor argument, the sink's buffer are all allocated from resource
+         */
+        logger(std::allocator_arg_t, std::pmr::memory_resource* resource, auto&&... args)
+            : m_metrics(resource), m_dimensions(resource), m_logs(resource), m_sink(make_sink(resource, args...)) {}
+
         ~logger() {
             if (m_sink.generate())
                 write();
@@ -630,59 +2749,140 @@ namespace cw_emf {
         }
 
 
-        template<int index> void dimension_value(const std::string& value) {
+        template<int index> void dimension_value(std::string_view value) {
             m_dimensions.template value<index>(value);
         }
-        template<internal::named name> void dimension_value(const std::string& value) {
+        template<internal::named name> void dimension_value(std::string_view value) {
             m_dimensions.template value_by_name<name>(value);
         }
 
 
-        template<int index> void log_value(const std::string& value) {
+        template<int index> void log_value(std::string_view value) {
             m_logs.template value<index>(value);
         }
 
-        template<internal::named name> void log_value(const std::string& value) {
+        template<internal::named name> void log_value(std::string_view value) {
             m_logs.template value_by_name<name>(value);
         }
 
         void flush() {
             write();
         }
+
+        /**
+         * Upper bound of one EMF message written by output_sink_string, including the newline, when no dimension
+         * or log value is longer than max_value_size bytes. Only available when all metrics are bounded.
+         */
+        static constexpr std::size_t max_message_size(std::size_t max_value_size = 0) requires (metrics::bounded()) {
+            return 1 + header_open_fragment.view().size() + internal::max_chars<std::int64_t>()
+                + namespace_fragment.view().size()
+                + dimensions::max_size(max_value_size)
+                + metrics::max_size()
+                + header_close_fragment.view().size()
+                + logs::max_size(max_value_size)
+                + 2;
+        }
+
+        /**
+         * Upper bound of everything a flush writes to output_sink_string
+         */
+        static constexpr std::size_t max_output_size(std::size_t max_value_size = 0) requires (metrics::bounded()) {
+            return metrics::max_messages() * max_message_size(max_value_size);
+        }
+
     private:
         metrics m_metrics;
         dimensions m_dimensions;
         logs m_logs;
         sink_t m_sink;
 
+        /**
+         * Static parts of the _aws header, rendered once per logger type
+         */
+        static constexpr auto header_open_fragment = internal::make_fragment<[] {
+            return internal::json_key("_aws") + " {" + internal::json_key("Timestamp");
+        }>();
+
+        static constexpr auto namespace_fragment = internal::make_fragment<[] {
+            return "," + internal::json_key("CloudWatchMetrics") + " [{" + internal::json_key("Namespace") + internal::json_string(emf_namespace.name());
+        }>();
+
+        static constexpr auto header_close_fragment = internal::make_fragment<[] {
+            return std::string("}]}");
+        }>();
+
+        static sink_t make_sink(std::pmr::memory_resource* resource, auto&&... args) {
+            if constexpr(std::constructible_from<sink_t, decltype(args)..., internal::resource_argument>)
+                return sink_t(args..., internal::resource_argument{resource});
+            else
+                return sink_t(args...);
+        }
+
         void write() {
+            if constexpr(internal::emf_size_limited_sink_c<sink_t>) {
+                // Halves the values per message until every message fits, or there is only one left
+                std::size_t start = m_sink.size();
+                int values_per_block = metrics::block_size;
+                while (!write_messages(values_per_block) && values_per_block > 1) {
+                    m_sink.truncate(start);
+                    values_per_block /= 2;
+                }
+            } else {
+                write_messages(metrics::block_size);
+            }
+
+            m_sink.done();
+        }
+
+        /**
+         * Writes one message per block of values, returns whether all of them fit into the sink's limit
+         */
+        bool write_messages(int values_per_block) {
+            bool fit{true};
+
+            for (int block=0; block <= m_metrics.num_blocks(values_per_block); ++block) {
+                [[maybe_unused]] std::size_t message_start{0};
+                if constexpr(internal::emf_size_limited_sink_c<sink_t>)
+                    message_start = m_sink.size();
 
-            for (int block=0; block <= m_metrics.num_blocks(); ++block) {
                 m_sink.open_root_object();
 
                 // Header
-                m_sink.open_object("_aws");
-                m_sink.write_value("Timestamp", std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count());
-                m_sink.write_next_element();
-
-                // CloudWatchMetrics Header
-                m_sink.open_array("CloudWatchMetrics");
-                m_sink.open_object();
+                auto timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+
+                if constexpr(internal::emf_fragment_sink_c<sink_t>) {
+                    m_sink.write_fragment(header_open_fragment.view());
+                    m_sink.write_value(timestamp);
+                    m_sink.write_fragment(namespace_fragment.view());
+                } else {
+                    m_sink.open_object("_aws");
+                    m_sink.write_value("Timestamp", timestamp);
+                    m_sink.write_next_element();
+
+                    // CloudWatchMetrics Header
+                    m_sink.open_array("CloudWatchMetrics");
+                    m_sink.open_object();
+
+                    m_sink.write_value("Namespace", emf_namespace.name());
+                }
 
-                m_sink.write_value("Namespace", emf_namespace.name());
                 m_dimensions.write_header(m_sink);
-                m_metrics.write_header(m_sink, block);
-
-                m_sink.close_object();
-                m_sink.close_array();
-                // Close Header
-                m_sink.close_object();
+                m_metrics.write_header(m_sink, block, values_per_block);
+
+                if constexpr(internal::emf_fragment_sink_c<sink_t>) {
+                    m_sink.write_fragment(header_close_fragment.view());
+                } else {
+                    m_sink.close_object();
+                    m_sink.close_array();
+                    // Close Header
+                    m_sink.close_object();
+                }
 
                 // Data Section
                 if constexpr(metrics::size() > 0 || dimensions::size() > 0) {
 
                     m_dimensions.write_values(m_sink);
-                    m_metrics.write_values(m_sink, block);
+                    m_metrics.write_values(m_sink, block, values_per_block);
 
                 }
 
@@ -692,14 +2892,242 @@ namespace cw_emf {
 
                 m_sink.close_root_object();
 
+                if constexpr(internal::emf_size_limited_sink_c<sink_t>) {
+                    fit = fit && m_sink.size() - message_start <= sink_t::max_message_size();
+                    // Written again with fewer values anyway
+                    if (!fit && values_per_block > 1)
+                        return false;
+                }
             }
 
-            m_sink.done();
+            return fit;
         }
 
     };
 
 
+    namespace internal {
+
+        /**
+         * Index of the calling thread, the lowest one not taken by another running thread. Taking and returning
+         * an index locks a mutex once per thread, looking it up afterwards is a plain thread local read.
+         */
+        inline std::size_t thread_slot() {
+            struct slots {
+                std::mutex mutex;
+                std::vector<bool> taken;
+
+                // Only taking and returning a slot checks the guard of the static, not every lookup
+                static slots& all() {
+                    static slots all;
+                    return all;
+                }
+            };
+
+            struct slot {
+                std::size_t index;
+
+                slot() {
+                    auto& all = slots::all();
+                    std::lock_guard lock(all.mutex);
+                    index = std::find(all.taken.begin(), all.taken.end(), false) - all.taken.begin();
+                    if (index == all.taken.size())
+                        all.taken.push_back(true);
+                    else
+                        all.taken[index] = true;
+                }
+
+                ~slot() {
+                    auto& all = slots::all();
+                    std::lock_guard lock(all.mutex);
+                    all.taken[index] = false;
+                }
+            };
+            thread_local slot current;
+
+            return current.index;
+        }
+
+        /**
+         * Whether process_fence() is available. The first call registers the process for it.
+         */
+        inline bool has_process_fence() {
+#if defined(__linux__) && defined(MEMBARRIER_CMD_PRIVATE_EXPEDITED)
+            static const bool registered = ::syscall(__NR_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0, 0) == 0;
+            return registered;
+#else
+            return false;
+#endif
+        }
+
+        /**
+         * A fence on every thread of the process at once, with membarrier. Threads that only order their accesses
+         * against the compiler with std::atomic_signal_fence are then ordered against the caller as if both had run
+         * a sequentially consistent fence. Only to be called once has_process_fence() returned true.
+         */
+        inline void process_fence() {
+#if defined(__linux__) && defined(MEMBARRIER_CMD_PRIVATE_EXPEDITED)
+            ::syscall(__NR_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0, 0);
+#endif
+        }
+    }
+
+    /**
+     * Logger for many threads recording the same metrics. Every thread puts its values into its own cache line
+     * aligned shard of the metrics, found through internal::thread_slot(), and a flush merges all shards into one
+     * set of messages. Threads beyond the first shards share one more shard behind a mutex.
+     *
+     * Values can be put from any thread at once, also while flush() runs on another thread, so a service can flush
+     * periodically while its workers keep going. Each shard has two copies of the metrics: flush() switches the
+     * owning thread to the other one, waits for a put still going to the old one and merges it. A put only stores
+     * to its own shard, the ordering against flush() comes from internal::process_fence() on the flushing side.
+     * Where that is not available, a spin lock per shard that only flush() contends for guards the puts instead.
+     *
+     * Dimension and log values, flush() itself and the destructor must not run concurrently with each other, the
+     * destructor not with puts either.
+     */
+    template<internal::named emf_namespace,
+            typename metrics,
+            typename dimensions = dimensions<>,
+            typename logs = log_messages<>,
+            internal::emf_msg_sink_c sink_t=output_sink_stdout,
+            std::size_t shards = 64>
+    class sharded_logger {
+    public:
+        sharded_logger(auto&&... args) requires (!(std::same_as<std::remove_cvref_t<decltype(args)>, std::allocator_arg_t> || ...))
+            : m_logger(args...), m_shards(shards) {}
+
+        /**
+         * The merged metrics, dimension and log values and the sink are allocated from resource, the shards of the
+         * threads from the default resource
+         */
+        sharded_logger(std::allocator_arg_t, std::pmr::memory_resource* resource, auto&&... args)
+            : m_logger(std::allocator_arg, resource, args...), m_resource{resource}, m_shards(shards) {}
+
+        ~sharded_logger() {
+            merge();
+        }
+
+        template<int index> void put_metrics_value(auto value) {
+            with_shard([&](metrics& shard) {
+                shard.template put_value<index>(value);
+            });
+        }
+        template<internal::named name> void put_metrics_value(auto value) {
+            with_shard([&](metrics& shard) {
+                shard.template put_value_by_name<name>(value);
+            });
+        }
+
+        template<int index> void dimension_value(std::string_view value) {
+            m_logger.template dimension_value<index>(value);
+        }
+        template<internal::named name> void dimension_value(std::string_view value) {
+            m_logger.template dimension_value<name>(value);
+        }
+
+        template<int index> void log_value(std::string_view value) {
+            m_logger.template log_value<index>(value);
+        }
+        template<internal::named name> void log_value(std::string_view value) {
+            m_logger.template log_value<name>(value);
+        }
+
+        /**
+         * Writes the values of all threads put since the last flush
+         */
+        void flush() {
+            merge();
+            m_logger.flush();
+        }
+
+    private:
+        struct alignas(internal::cache_line_size) shard {
+            metrics values[2];
+            std::atomic<unsigned> active{0};        // the copy puts go to, only flush() changes it
+            std::atomic<std::size_t> sequence{0};   // odd while the owning thread puts a value
+            std::atomic<bool> busy{false};          // without a process fence
+
+            /**
+             * Only flush() competes with the owning thread, which hardly ever has to spin
+             */
+            void lock() {
+                while (busy.exchange(true, std::memory_order_acquire))
+                    std::this_thread::yield();
+            }
+
+            void unlock() {
+                busy.store(false, std::memory_order_release);
+            }
+        };
+
+        logger<emf_namespace, metrics, dimensions, logs, sink_t> m_logger;
+        std::pmr::memory_resource* m_resource{std::pmr::get_default_resource()};
+        std::vector<shard> m_shards;
+        shard m_shared;
+        std::mutex m_shared_mutex;
+        const bool m_fenced{internal::has_process_fence()};
+
+        void with_shard(auto&& f) {
+            std::size_t slot = internal::thread_slot();
+            if (slot >= shards) {
+                std::lock_guard lock(m_shared_mutex);
+                f(m_shared.values[0]);
+                return;
+            }
+
+            auto& shard = m_shards[slot];
+            if (m_fenced) {
+                // Plain stores by the owning thread, flush()'s process fence orders them against its switch
+                std::size_t sequence = shard.sequence.load(std::memory_order_relaxed);
+                shard.sequence.store(sequence + 1, std::memory_order_relaxed);
+                std::atomic_signal_fence(std::memory_order_seq_cst);
+                f(shard.values[shard.active.load(std::memory_order_acquire)]);
+                shard.sequence.store(sequence + 2, std::memory_order_release);
+            } else {
+                std::lock_guard lock(shard);
+                f(shard.values[0]);
+            }
+        }
+
+        /**
+         * Replaces the logger's metrics by the merged values of all shards and empties the shards. With a process
+         * fence, every shard is switched to its other copy first, then the old copies are merged once no put is
+         * still writing to them. Without one, each shard is merged while holding its lock.
+         */
+        void merge() {
+            m_logger.m_metrics = metrics(m_resource);
+
+            if (m_fenced) {
+                for (auto& shard: m_shards)
+                    shard.active.store(1 - shard.active.load(std::memory_order_relaxed), std::memory_order_release);
+
+                // Every put from here on sees the switch, one that is still going shows an odd sequence
+                internal::process_fence();
+                for (auto& shard: m_shards) {
+                    std::size_t sequence = shard.sequence.load(std::memory_order_acquire);
+                    while (sequence % 2 == 1 && shard.sequence.load(std::memory_order_acquire) == sequence)
+                        std::this_thread::yield();
+
+                    auto& old = shard.values[1 - shard.active.load(std::memory_order_relaxed)];
+                    m_logger.m_metrics.merge(old);
+                    old = metrics();
+                }
+            } else {
+                for (auto& shard: m_shards) {
+                    std::lock_guard lock(shard);
+                    m_logger.m_metrics.merge(shard.values[0]);
+                    shard.values[0] = metrics();
+                }
+            }
+
+            std::lock_guard lock(m_shared_mutex);
+            m_logger.m_metrics.merge(m_shared.values[0]);
+            m_shared.values[0] = metrics();
+        }
+    };
+
+
 }
 
 
@@ -0,0 +1,214 @@
+//
+// Sink sending the metrics of EMF messages straight to CloudWatch with PutMetricData, through the AWS SDK
+//
+
+#ifndef BASE_CW_EMF_CLOUDWATCH_H
+#define BASE_CW_EMF_CLOUDWATCH_H
+
+#include "cw_emf_metric_data.h"
+
+#include <aws/core/utils/DateTime.h>
+#include <aws/monitoring/CloudWatchClient.h>
+#include <aws/monitoring/model/Dimension.h>
+#include <aws/monitoring/model/MetricDatum.h>
+#include <aws/monitoring/model/PutMetricDataRequest.h>
+#include <aws/monitoring/model/StandardUnit.h>
+#include <aws/monitoring/model/StatisticSet.h>
+
+#include <condition_variable>
+
+namespace cw_emf {
+
+    /**
+     * Aggregates the metrics of EMF messages per namespace, metric, unit and dimension values, and sends them with
+     * PutMetricData every interval. Requests are submitted with the client's PutMetricDataAsync, on the client's
+     * executor, and never wait on the loggers. Any number of threads can share a writer.
+     */
+    class put_metric_data_writer {
+    public:
+        static constexpr std::size_t max_metric_data = metric_data_aggregate::max_metric_data;
+
+        explicit put_metric_data_writer(std::shared_ptr<Aws::CloudWatch::CloudWatchClient> client,
+                                        std::chrono::milliseconds interval = std::chrono::seconds(60),
+                                        std::size_t metric_data_per_request = max_metric_data)
+            : m_client{std::move(client)}, m_interval{interval}, m_metric_data_per_request{metric_data_per_request} {
+            if (!m_client)
+                throw std::invalid_argument("put_metric_data_writer needs a client");
+            if (metric_data_per_request == 0 || metric_data_per_request > max_metric_data)
+                throw std::out_of_range("metric_data_per_request must be between 1 and " + std::to_string(max_metric_data));
+
+            m_thread = std::thread([this] { run(); });
+        }
+
+        put_metric_data_writer(const put_metric_data_writer&) = delete;
+        put_metric_data_writer& operator=(const put_metric_data_writer&) = delete;
+
+        /**
+         * Sends what is left and waits for all requests, whose handlers refer to the writer
+         */
+        ~put_metric_data_writer() {
+            {
+                std::lock_guard lock(m_mutex);
+                m_stop = true;
+            }
+            m_wake.notify_one();
+            m_thread.join();
+
+            submit();
+            std::unique_lock lock(m_mutex);
+            m_completed.wait(lock, [this] { return m_in_flight == 0; });
+        }
+
+        /**
+         * Sends everything added so far without waiting for the interval, then waits up to timeout until all
+         * requests completed and returns whether they did
+         */
+        bool flush(std::chrono::milliseconds timeout) {
+            submit();
+            std::unique_lock lock(m_mutex);
+            return m_completed.wait_for(lock, timeout, [this] { return m_in_flight == 0; });
+        }
+
+        /**
+         * Number of PutMetricData requests that completed, successfully or not
+         */
+        std::size_t requests() const {
+            return m_requests.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Number of PutMetricData requests that failed after the client's retries, their metric data is lost
+         */
+        std::size_t failed_requests() const {
+            return m_failed_requests.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Number of metric data sent successfully
+         */
+        std::size_t metric_data() const {
+            return m_metric_data.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Number of messages that were not sent because a declared dimension had no value, or a dimension set had
+         * more than metric_data_aggregate::max_dimensions dimensions. PutMetricData would reject the whole request.
+         */
+        std::size_t errors() const {
+            return m_errors.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Merges the metric data of a sink's flush into the data waiting for the next interval and leaves data empty
+         */
+        void add(metric_data_aggregate& data, std::size_t errors) {
+            if (errors > 0)
+                m_errors.fetch_add(errors, std::memory_order_relaxed);
+            if (data.empty())
+                return;
+
+            std::lock_guard lock(m_mutex);
+            m_data.merge(data);
+        }
+
+    private:
+        std::shared_ptr<Aws::CloudWatch::CloudWatchClient> m_client;
+        std::chrono::milliseconds m_interval;
+        std::size_t m_metric_data_per_request;
+
+        std::mutex m_mutex;
+        std::condition_variable m_wake;
+        std::condition_variable m_completed;
+        metric_data_aggregate m_data;
+        std::size_t m_in_flight{0};
+        bool m_stop{false};
+
+        std::atomic<std::size_t> m_requests{0};
+        std::atomic<std::size_t> m_failed_requests{0};
+        std::atomic<std::size_t> m_metric_data{0};
+        std::atomic<std::size_t> m_errors{0};
+
+        std::thread m_thread;
+
+        void run() {
+            std::unique_lock lock(m_mutex);
+            while (!m_wake.wait_for(lock, m_interval, [this] { return m_stop; })) {
+                lock.unlock();
+                submit();
+                lock.lock();
+            }
+        }
+
+        /**
+         * Takes all metric data and submits them in requests of one namespace each, within the API's limits
+         */
+        void submit() {
+            metric_data_aggregate data;
+            {
+                std::lock_guard lock(m_mutex);
+                data.merge(m_data);
+            }
+
+            data.split(m_metric_data_per_request, [this](const std::vector<const metric_datum*>& request_data) {
+                Aws::CloudWatch::Model::PutMetricDataRequest request;
+                request.SetNamespace(aws_string(request_data.front()->emf_namespace));
+                for (auto* datum: request_data)
+                    request.AddMetricData(to_datum(*datum));
+                send(std::move(request));
+            });
+        }
+
+        static Aws::String aws_string(const std::string& value) {
+            return Aws::String(value.data(), value.size());
+        }
+
+        static Aws::CloudWatch::Model::MetricDatum to_datum(const metric_datum& values) {
+            using namespace Aws::CloudWatch::Model;
+
+            MetricDatum datum;
+            datum.SetMetricName(aws_string(values.name));
+            datum.SetUnit(StandardUnitMapper::GetStandardUnitForName(aws_string(values.unit)));
+            datum.SetTimestamp(Aws::Utils::DateTime(values.timestamp));
+            for (auto& [dimension, value]: values.dimensions)
+                datum.AddDimensions(Dimension().WithName(aws_string(dimension)).WithValue(aws_string(value)));
+
+            if (values.statistics_only) {
+                datum.SetStatisticValues(StatisticSet().WithSampleCount(values.sample_count).WithSum(values.sum)
+                                             .WithMinimum(values.minimum).WithMaximum(values.maximum));
+            } else {
+                for (auto [value, count]: values.counts) {
+                    datum.AddValues(value);
+                    datum.AddCounts(count);
+                }
+            }
+            return datum;
+        }
+
+        void send(Aws::CloudWatch::Model::PutMetricDataRequest request) {
+            {
+                std::lock_guard lock(m_mutex);
+                ++m_in_flight;
+            }
+
+            std::size_t metric_data = request.GetMetricData().size();
+            m_client->PutMetricDataAsync(request, [this, metric_data](auto*, const auto&, const auto& outcome, const auto&) {
+                m_requests.fetch_add(1, std::memory_order_relaxed);
+                if (outcome.IsSuccess())
+                    m_metric_data.fetch_add(metric_data, std::memory_order_relaxed);
+                else
+                    m_failed_requests.fetch_add(1, std::memory_order_relaxed);
+
+                std::lock_guard lock(m_mutex);
+                --m_in_flight;
+                m_completed.notify_all();
+            });
+        }
+    };
+
+    /**
+     * Sink handing the metrics of its messages to a put_metric_data_writer, which sends them with PutMetricData
+     */
+    using output_sink_put_metric_data = basic_output_sink_metric_data<put_metric_data_writer>;
+}
+
+#endif //BASE_CW_EMF_CLOUDWATCH_H
@@ -0,0 +1,391 @@
+//
+// Metric data for PutMetricData, aggregated straight from the calls a logger makes on its sink. Nothing in here
+// needs the AWS SDK, cw_emf_cloudwatch.h sends the data through it.
+//
+
+#ifndef BASE_CW_EMF_METRIC_DATA_H
+#define BASE_CW_EMF_METRIC_DATA_H
+
+#include "cw_emf.h"
+
+#include <map>
+#include <utility>
+
+namespace cw_emf {
+
+    /**
+     * The values of one metric with one set of dimension values, one datum of a PutMetricData request. The distinct
+     * values are counted as long as they fit into one datum, after that only the statistic set is kept.
+     */
+    struct metric_datum {
+        static constexpr std::size_t max_values = 150;             // per datum, in Values and Counts
+
+        std::string emf_namespace;
+        std::string name;
+        std::string unit;
+        std::vector<std::pair<std::string, std::string>> dimensions;
+        std::int64_t timestamp{0};
+
+        std::map<double, double> counts;
+        bool statistics_only{false};
+        double sample_count{0};
+        double sum{0};
+        double minimum{std::numeric_limits<double>::infinity()};
+        double maximum{-std::numeric_limits<double>::infinity()};
+
+        void add(double value, double count) {
+            if (!std::isfinite(value) || !(count > 0))
+                return;
+
+            sample_count += count;
+            sum += value * count;
+            minimum = std::min(minimum, value);
+            maximum = std::max(maximum, value);
+
+            if (!statistics_only) {
+                counts[value] += count;
+                if (counts.size() > max_values) {
+                    statistics_only = true;
+                    counts.clear();
+                }
+            }
+        }
+
+        void merge(const metric_datum& other) {
+            timestamp = std::min(timestamp, other.timestamp);
+            if (other.statistics_only) {
+                statistics_only = true;
+                counts.clear();
+                sample_count += other.sample_count;
+                sum += other.sum;
+                minimum = std::min(minimum, other.minimum);
+                maximum = std::max(maximum, other.maximum);
+            } else {
+                for (auto [value, count]: other.counts)
+                    add(value, count);
+            }
+        }
+
+        /**
+         * Rough size of the datum in a request, Values and Counts make up most of it
+         */
+        std::size_t encoded_size() const {
+            std::size_t size = 256 + name.size() + 128 * counts.size();
+            for (auto& [dimension, value]: dimensions)
+                size += 96 + dimension.size() + value.size();
+            return size;
+        }
+    };
+
+    /**
+     * Metric data aggregated per namespace, metric, unit and dimension values, and split into requests within the
+     * limits of PutMetricData
+     */
+    class metric_data_aggregate {
+    public:
+        static constexpr std::size_t max_metric_data = 1000;       // per request
+        static constexpr std::size_t max_dimensions = 30;          // per datum
+        static constexpr std::size_t max_request_size = 1000000;   // bytes of an encoded request
+
+        /**
+         * Adds datum, or merges it into the one with the same namespace, metric, unit and dimension values
+         */
+        void add(metric_datum datum) {
+            std::string key = datum.emf_namespace + '\0' + datum.name + '\0' + datum.unit;
+            for (auto& [dimension, value]: datum.dimensions)
+                key += '\0' + dimension + '\0' + value;
+
+            auto [position, inserted] = m_data.try_emplace(std::move(key), std::move(datum));
+            if (!inserted)
+                position->second.merge(datum);
+        }
+
+        /**
+         * Merges all of other into this and leaves other empty
+         */
+        void merge(metric_data_aggregate& other) {
+            if (m_data.empty()) {
+                std::swap(m_data, other.m_data);
+                return;
+            }
+            for (auto& [key, datum]: other.m_data) {
+                auto [position, inserted] = m_data.try_emplace(key, std::move(datum));
+                if (!inserted)
+                    position->second.merge(datum);
+            }
+            other.m_data.clear();
+        }
+
+        bool empty() const {
+            return m_data.empty();
+        }
+
+        std::size_t size() const {
+            return m_data.size();
+        }
+
+        void clear() {
+            m_data.clear();
+        }
+
+        /**
+         * Calls send with the data of each request: all of one namespace, at most metric_data_per_request data and
+         * max_request_size bytes
+         */
+        void split(std::size_t metric_data_per_request, auto&& send) const {
+            std::vector<const metric_datum*> request;
+            std::size_t request_size = 0;
+            for (auto& [key, datum]: m_data) {
+                std::size_t size = datum.encoded_size();
+                if (!request.empty() && (request.front()->emf_namespace != datum.emf_namespace
+                        || request.size() == metric_data_per_request || request_size + size > max_request_size)) {
+                    send(std::as_const(request));
+                    request.clear();
+                    request_size = 0;
+                }
+                request.push_back(&datum);
+                request_size += size;
+            }
+
+            if (!request.empty())
+                send(std::as_const(request));
+        }
+
+    private:
+        std::map<std::string, metric_datum> m_data;     // ordered by namespace first
+    };
+
+    /**
+     * Sink turning the metrics of its messages into metric data and handing them to target_t, which takes them with
+     * add(metric_data_aggregate&, std::size_t errors) on every flush. Nothing is rendered: the sink follows the
+     * logger's calls, keeps the header and values of each message and aggregates them. Log values are dropped.
+     *
+     * A message that lacks the value of a declared dimension, or has a dimension set with more than max_dimensions
+     * dimensions, is not aggregated but counted in errors, PutMetricData would reject the whole request with it.
+     */
+    template<typename target_t>
+    class basic_output_sink_metric_data {
+    public:
+        explicit basic_output_sink_metric_data(target_t& target): m_target{target} {}
+
+        void open_root_object() {
+            m_depth = 0;
+            m_timestamp = 0;
+            m_namespace.clear();
+            m_dimension_sets.clear();
+            m_metrics.clear();
+            m_values.clear();
+            m_current = nullptr;
+        }
+
+        void close_root_object() {
+            add_message();
+        }
+
+        void open_object() {
+            if (in_header("Metrics"))
+                m_metrics.emplace_back();
+            push({});
+        }
+        void open_object(std::string_view name) {
+            if (m_depth == 0)
+                m_current = find_metric(name);
+            push(name);
+        }
+        void close_object() {
+            pop();
+        }
+
+        void open_array() {
+            if (in_header("Dimensions"))
+                m_dimension_sets.emplace_back();
+            push({});
+        }
+        void open_array(std::string_view name) {
+            if (m_depth == 0)
+                m_current = find_metric(name);
+            push(name);
+        }
+        void close_array() {
+            pop();
+        }
+
+        void write_next_element() {}
+
+        void write_value(std::string_view name, const std::string& value) {
+            write_value(name, std::string_view(value));
+        }
+        void write_value(std::string_view name, const char* value) {
+            write_value(name, std::string_view(value));
+        }
+        void write_value(std::string_view name, std::string_view value) {
+            if (m_depth == 0) {
+                m_values.emplace_back(name, value);
+            } else if (m_depth == 3 && name == "Namespace") {
+                m_namespace = value;
+            } else if (in_header("Metrics", 1) && !m_metrics.empty()) {
+                if (name == "Name")
+                    m_metrics.back().name = value;
+                else if (name == "Unit")
+                    m_metrics.back().unit = value;
+            }
+        }
+        void write_value(std::string_view, bool) {}
+        void write_value(std::string_view name, std::integral auto value) {
+            write_number(name, static_cast<double>(value));
+        }
+        void write_value(std::string_view name, std::floating_point auto value) {
+            write_number(name, static_cast<double>(value));
+        }
+        void write_value(std::string_view name, std::floating_point auto value, internal::number_format) {
+            write_number(name, static_cast<double>(value));
+        }
+
+        void write_value(const std::string& value) {
+            write_value(std::string_view(value));
+        }
+        void write_value(const char* value) {
+            write_value(std::string_view(value));
+        }
+        void write_value(std::string_view value) {
+            if (in_header("Dimensions", 1) && !m_dimension_sets.empty())
+                m_dimension_sets.back().emplace_back(value);
+        }
+        void write_value(bool) {}
+        void write_value(std::integral auto value) {
+            write_number(static_cast<double>(value));
+        }
+        void write_value(std::floating_point auto value) {
+            write_number(static_cast<double>(value));
+        }
+        void write_value(std::floating_point auto value, internal::number_format) {
+            write_number(static_cast<double>(value));
+        }
+
+        void done() {
+            m_target.add(m_data, m_errors);
+            m_data.clear();
+            m_errors = 0;
+        }
+
+        constexpr bool generate() const {
+            return true;
+        }
+
+    private:
+        struct metric {
+            std::string name;
+            std::string unit{"None"};
+            std::vector<double> values;
+            std::vector<double> counts;
+        };
+
+        target_t& m_target;
+
+        // Names of the open containers below the root object, kept with their capacity across messages
+        std::vector<std::string> m_path;
+        std::size_t m_depth{0};
+
+        std::int64_t m_timestamp{0};
+        std::string m_namespace;
+        std::vector<std::vector<std::string>> m_dimension_sets;
+        std::vector<metric> m_metrics;
+        std::vector<std::pair<std::string, std::string>> m_values;
+        metric* m_current{nullptr};
+
+        metric_data_aggregate m_data;
+        std::size_t m_errors{0};
+
+        void push(std::string_view name) {
+            if (m_depth == m_path.size())
+                m_path.emplace_back();
+            m_path[m_depth++].assign(name);
+        }
+
+        void pop() {
+            if (m_depth > 0 && --m_depth == 0)
+                m_current = nullptr;
+        }
+
+        /**
+         * Whether the innermost containers are _aws.CloudWatchMetrics[].section, plus nested more of them
+         */
+        bool in_header(std::string_view section, std::size_t nested = 0) const {
+            return m_depth == 4 + nested && m_path[0] == "_aws" && m_path[1] == "CloudWatchMetrics" && m_path[3] == section;
+        }
+
+        metric* find_metric(std::string_view name) {
+            auto position = std::find_if(m_metrics.begin(), m_metrics.end(), [name](const metric& m) { return m.name == name; });
+            return position == m_metrics.end() ? nullptr : &*position;
+        }
+
+        void write_number(std::string_view name, double value) {
+            if (m_depth == 0) {
+                if (auto* single = find_metric(name))
+                    single->values.push_back(value);
+            } else if (m_depth == 1 && name == "Timestamp" && m_path[0] == "_aws") {
+                m_timestamp = static_cast<std::int64_t>(value);
+            }
+        }
+
+        /**
+         * Values of the metric being written, an array of them or the Values and Counts of a counted metric
+         */
+        void write_number(double value) {
+            if (m_current == nullptr)
+                return;
+            if (m_depth == 1 || (m_depth == 2 && m_path[1] == "Values"))
+                m_current->values.push_back(value);
+            else if (m_depth == 2 && m_path[1] == "Counts")
+                m_current->counts.push_back(value);
+        }
+
+        const std::string* find_value(std::string_view name) const {
+            for (auto& [value_name, value]: m_values)
+                if (value_name == name)
+                    return &value;
+            return nullptr;
+        }
+
+        /**
+         * Turns the message into one datum per metric and dimension set, or counts it as an error
+         */
+        void add_message() {
+            for (auto& dimensions: m_dimension_sets) {
+                bool valid = dimensions.size() <= metric_data_aggregate::max_dimensions;
+                for (auto& dimension: dimensions) {
+                    auto* value = find_value(dimension);
+                    valid = valid && value != nullptr && !value->empty();
+                }
+                if (!valid) {
+                    ++m_errors;
+                    return;
+                }
+            }
+
+            for (auto& values: m_metrics) {
+                metric_datum datum;
+                datum.emf_namespace = m_namespace;
+                datum.name = values.name;
+                datum.unit = values.unit;
+                datum.timestamp = m_timestamp;
+                for (std::size_t i = 0; i < values.values.size(); ++i)
+                    datum.add(values.values[i], i < values.counts.size() ? values.counts[i] : 1);
+                if (datum.sample_count == 0)
+                    continue;
+
+                // No dimension sets at all is a metric without dimensions, like one empty set
+                for (std::size_t k = 0; k < std::max<std::size_t>(m_dimension_sets.size(), 1); ++k) {
+                    auto with_dimensions = datum;
+                    if (!m_dimension_sets.empty()) {
+                        for (auto& dimension: m_dimension_sets[k])
+                            with_dimensions.dimensions.emplace_back(dimension, *find_value(dimension));
+                    }
+                    m_data.add(std::move(with_dimensions));
+                }
+            }
+        }
+    };
+}
+
+#endif //BASE_CW_EMF_METRIC_DATA_H
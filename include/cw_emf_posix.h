@@ -0,0 +1,1673 @@
+//
+// Sinks writing EMF messages straight to POSIX file descriptors
+//
+
+#ifndef BASE_CW_EMF_POSIX_H
+#define BASE_CW_EMF_POSIX_H
+
+#include "cw_emf.h"
+
+#include <condition_variable>
+#include <semaphore>
+#include <system_error>
+#include <utility>
+
+#include <cerrno>
+#include <climits>
+#include <cstddef>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#if !defined(CW_EMF_URING) && defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define CW_EMF_URING 1
+#endif
+
+#if CW_EMF_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#endif
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace cw_emf {
+
+    namespace internal {
+
+        /**
+         * Writes all of data to fd, continuing after partial writes and EINTR. Returns false on any other error,
+         * written has the bytes that made it to fd either way.
+         */
+        inline bool write_all(int fd, const char* data, std::size_t size, std::size_t& written) {
+            written = 0;
+            while (size > 0) {
+                ssize_t result = ::write(fd, data, size);
+                if (result < 0) {
+                    if (errno == EINTR)
+                        continue;
+                    return false;
+                }
+                data += result;
+                size -= result;
+                written += result;
+            }
+            return true;
+        }
+
+        /**
+         * Writes all of data to fd, continuing after partial writes and EINTR. Returns false on any other error.
+         */
+        inline bool write_all(int fd, const char* data, std::size_t size) {
+            std::size_t written;
+            return write_all(fd, data, size, written);
+        }
+
+        /**
+         * Writes all of the count buffers in iov to fd with writev, at most IOV_MAX at a time, continuing after
+         * partial writes and EINTR. iov is advanced past what was written. Returns false on any other error.
+         */
+        inline bool writev_all(int fd, ::iovec* iov, std::size_t count) {
+            while (count > 0) {
+                ssize_t written = ::writev(fd, iov, static_cast<int>(std::min<std::size_t>(count, IOV_MAX)));
+                if (written < 0) {
+                    if (errno == EINTR)
+                        continue;
+                    return false;
+                }
+
+                auto remaining = static_cast<std::size_t>(written);
+                while (count > 0 && remaining >= iov->iov_len) {
+                    remaining -= iov->iov_len;
+                    ++iov;
+                    --count;
+                }
+                if (remaining > 0) {
+                    iov->iov_base = static_cast<char*>(iov->iov_base) + remaining;
+                    iov->iov_len -= remaining;
+                }
+            }
+            return true;
+        }
+
+        /**
+         * Fills address with a numeric IPv4 or IPv6 host and a port, returns its length
+         */
+        inline ::socklen_t ip_address(const std::string& host, std::uint16_t port, ::sockaddr_storage& address) {
+            if (auto* v4 = reinterpret_cast<::sockaddr_in*>(&address); ::inet_pton(AF_INET, host.c_str(), &v4->sin_addr) == 1) {
+                v4->sin_family = AF_INET;
+                v4->sin_port = htons(port);
+                return sizeof(::sockaddr_in);
+            }
+            if (auto* v6 = reinterpret_cast<::sockaddr_in6*>(&address); ::inet_pton(AF_INET6, host.c_str(), &v6->sin6_addr) == 1) {
+                v6->sin6_family = AF_INET6;
+                v6->sin6_port = htons(port);
+                return sizeof(::sockaddr_in6);
+            }
+            throw std::invalid_argument("not a numeric address: " + host);
+        }
+
+#if CW_EMF_URING
+        /**
+         * An io_uring set up with the raw system calls, its submission and completion rings mapped into the process.
+         * Only used from one thread.
+         */
+        class uring {
+        public:
+            explicit uring(unsigned entries) {
+                ::io_uring_params params{};
+                m_fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+                if (m_fd < 0)
+                    return;
+                m_features = params.features;
+
+                m_sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+                m_cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(::io_uring_cqe);
+                bool single_map = params.features & IORING_FEAT_SINGLE_MMAP;
+                if (single_map)
+                    m_sq_map_size = m_cq_map_size = std::max(m_sq_map_size, m_cq_map_size);
+                m_sqes_size = params.sq_entries * sizeof(::io_uring_sqe);
+
+                m_sq_map = map(m_sq_map_size, IORING_OFF_SQ_RING);
+                m_cq_map = single_map ? m_sq_map : map(m_cq_map_size, IORING_OFF_CQ_RING);
+                m_sqes = static_cast<::io_uring_sqe*>(map(m_sqes_size, IORING_OFF_SQES));
+                if (m_sq_map == MAP_FAILED || m_cq_map == MAP_FAILED || m_sqes == MAP_FAILED) {
+                    release();
+                    return;
+                }
+
+                auto* sq = static_cast<char*>(m_sq_map);
+                m_sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+                m_sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+                m_sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+                m_sq_entries = params.sq_entries;
+                m_sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+
+                auto* cq = static_cast<char*>(m_cq_map);
+                m_cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+                m_cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+                m_cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+                m_cqes = reinterpret_cast<::io_uring_cqe*>(cq + params.cq_off.cqes);
+            }
+
+            uring(const uring&) = delete;
+            uring& operator=(const uring&) = delete;
+
+            ~uring() {
+                release();
+            }
+
+            bool valid() const {
+                return m_fd >= 0;
+            }
+
+            /**
+             * The IORING_FEAT_ flags of the kernel
+             */
+            unsigned features() const {
+                return m_features;
+            }
+
+            bool register_buffers(const ::iovec* buffers, unsigned count) {
+                return ::syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_BUFFERS, buffers, count) == 0;
+            }
+
+            /**
+             * Whether the kernel supports opcode, false as well on kernels before 5.6 which cannot be probed
+             */
+            bool supports(unsigned opcode) const {
+                constexpr unsigned ops = 256;
+                alignas(::io_uring_probe) char storage[sizeof(::io_uring_probe) + ops * sizeof(::io_uring_probe_op)]{};
+                auto* probe = reinterpret_cast<::io_uring_probe*>(storage);
+                if (::syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_PROBE, probe, ops) != 0)
+                    return false;
+                return opcode <= probe->last_op && (probe->ops[opcode].flags & IO_URING_OP_SUPPORTED);
+            }
+
+            /**
+             * The next free submission queue entry, cleared, or null when the queue is full
+             */
+            ::io_uring_sqe* next_sqe() {
+                unsigned head = std::atomic_ref(*m_sq_head).load(std::memory_order_acquire);
+                if (m_sq_local_tail - head == m_sq_entries)
+                    return nullptr;
+
+                unsigned index = m_sq_local_tail++ & m_sq_mask;
+                m_sq_array[index] = index;
+                std::memset(&m_sqes[index], 0, sizeof(::io_uring_sqe));
+                return &m_sqes[index];
+            }
+
+            /**
+             * Number of entries taken with next_sqe that the kernel has not consumed yet
+             */
+            unsigned unsubmitted() const {
+                return m_sq_local_tail - std::atomic_ref(*m_sq_head).load(std::memory_order_acquire);
+            }
+
+            /**
+             * Number of entries next_sqe can hand out before the queue is full
+             */
+            unsigned free_entries() const {
+                return m_sq_entries - unsubmitted();
+            }
+
+            /**
+             * Submits the entries not submitted yet and waits for min_complete completions. Returns the
+             * result of io_uring_enter, a negative errno on failure.
+             */
+            int enter(unsigned min_complete = 0) {
+                std::atomic_ref(*m_sq_tail).store(m_sq_local_tail, std::memory_order_release);
+                // Counted from the head, entries an interrupted call left behind are submitted as well
+                unsigned to_submit = unsubmitted();
+
+                long result = ::syscall(__NR_io_uring_enter, m_fd, to_submit, min_complete,
+                                        min_complete > 0 ? IORING_ENTER_GETEVENTS : 0u, nullptr, 0);
+                return result < 0 ? -errno : static_cast<int>(result);
+            }
+
+            /**
+             * Calls handle with each completion queue entry and marks them as seen
+             */
+            unsigned reap(auto handle) {
+                unsigned head = std::atomic_ref(*m_cq_head).load(std::memory_order_relaxed);
+                unsigned tail = std::atomic_ref(*m_cq_tail).load(std::memory_order_acquire);
+                for (unsigned i=head; i != tail; ++i)
+                    handle(m_cqes[i & m_cq_mask]);
+                std::atomic_ref(*m_cq_head).store(tail, std::memory_order_release);
+                return tail - head;
+            }
+
+        private:
+            int m_fd{-1};
+            unsigned m_features{0};
+            void* m_sq_map{MAP_FAILED};
+            void* m_cq_map{MAP_FAILED};
+            ::io_uring_sqe* m_sqes{static_cast<::io_uring_sqe*>(MAP_FAILED)};
+            std::size_t m_sq_map_size{0};
+            std::size_t m_cq_map_size{0};
+            std::size_t m_sqes_size{0};
+
+            unsigned* m_sq_head{nullptr};
+            unsigned* m_sq_tail{nullptr};
+            unsigned* m_sq_array{nullptr};
+            unsigned m_sq_mask{0};
+            unsigned m_sq_entries{0};
+            unsigned m_sq_local_tail{0};
+
+            unsigned* m_cq_head{nullptr};
+            unsigned* m_cq_tail{nullptr};
+            unsigned m_cq_mask{0};
+            ::io_uring_cqe* m_cqes{nullptr};
+
+            void* map(std::size_t size, off_t offset) const {
+                return ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, offset);
+            }
+
+            void release() {
+                if (m_sqes != MAP_FAILED)
+                    ::munmap(m_sqes, m_sqes_size);
+                if (m_cq_map != MAP_FAILED && m_cq_map != m_sq_map)
+                    ::munmap(m_cq_map, m_cq_map_size);
+                if (m_sq_map != MAP_FAILED)
+                    ::munmap(m_sq_map, m_sq_map_size);
+                if (m_fd >= 0)
+                    ::close(m_fd);
+                m_fd = -1;
+                m_sq_map = m_cq_map = MAP_FAILED;
+                m_sqes = static_cast<::io_uring_sqe*>(MAP_FAILED);
+            }
+        };
+#endif
+    }
+
+    /**
+     * Writes the EMF messages to a file descriptor with a single writev per flush. Pre-rendered fragments are
+     * referenced where they are instead of being copied, only the values are formatted into a buffer of the sink.
+     * Fragments shorter than inline_fragment_size are copied anyway, an iovec for them costs more than the copy.
+     * The first 16 segments are kept inside the sink, a logger per request needs no allocation for them. Failed
+     * writes are counted in errors().
+     */
+    class output_sink_fd: public output_sink_pmr_string {
+    public:
+        static constexpr std::size_t inline_fragment_size = 32;
+
+        output_sink_fd(int fd = STDOUT_FILENO, bool validate_utf8 = false,
+                       std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+            : output_sink_pmr_string(m_buffer, validate_utf8), m_fd{fd}, m_buffer{resource}, m_segments{resource}, m_iov{resource} {}
+
+        output_sink_fd(int fd, std::pmr::memory_resource* resource): output_sink_fd(fd, false, resource) {}
+
+        void write_fragment(std::string_view fragment) {
+            if (fragment.size() < inline_fragment_size) {
+                m_buffer += fragment;
+                return;
+            }
+            add_buffered();
+            m_segments.push_back({fragment.data(), 0, fragment.size()});
+        }
+
+        void done() {
+            add_buffered();
+
+            // The buffer no longer grows, its segments can be resolved to pointers now
+            for (auto& segment: m_segments) {
+                const char* data = segment.fragment ? segment.fragment : m_buffer.data() + segment.offset;
+                m_iov.push_back({const_cast<char*>(data), segment.size});
+            }
+            if (!internal::writev_all(m_fd, m_iov.data(), m_iov.size()))
+                m_errors.fetch_add(1, std::memory_order_relaxed);
+
+            m_buffer.clear();
+            m_segments.clear();
+            m_iov.clear();
+            m_buffered = 0;
+        }
+
+        /**
+         * Number of flushes of all file descriptor sinks whose write failed
+         */
+        static std::size_t errors() {
+            return m_errors.load(std::memory_order_relaxed);
+        }
+
+    private:
+        /**
+         * A fragment, or a range of the buffer when fragment is null
+         */
+        struct segment {
+            const char* fragment;
+            std::size_t offset;
+            std::size_t size;
+        };
+
+        int m_fd;
+        std::pmr::string m_buffer;
+        internal::small_vector<segment, 16> m_segments;
+        internal::small_vector<::iovec, 16> m_iov;
+        std::size_t m_buffered{0};
+
+        static inline std::atomic<std::size_t> m_errors{0};
+
+        /**
+         * Adds what was formatted into the buffer since the last segment as a segment of its own
+         */
+        void add_buffered() {
+            if (m_buffer.size() > m_buffered) {
+                m_segments.push_back({nullptr, m_buffered, m_buffer.size() - m_buffered});
+                m_buffered = m_buffer.size();
+            }
+        }
+    };
+
+    /**
+     * Writes each EMF message to a file descriptor, stdout by default, with a write of at most PIPE_BUF bytes. Such
+     * writes reach a pipe in one piece, so the messages of loggers on different threads never interleave and no
+     * lock is needed. The sink asks the logger for messages of at most PIPE_BUF bytes, which writes fewer values
+     * per message until they fit. Consecutive messages share a write as long as it stays within PIPE_BUF.
+     *
+     * A message that does not fit even with one value per metric, for example because of a long log value, is
+     * written with a write of its own and counted in oversized(). It only interleaves with others when the pipe
+     * is too full to take it at once.
+     */
+    class output_sink_atomic: public output_sink_pmr_string {
+    public:
+        output_sink_atomic(int fd = STDOUT_FILENO, bool validate_utf8 = false,
+                           std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+            : output_sink_pmr_string(m_buffer, validate_utf8), m_fd{fd}, m_buffer{resource} {}
+
+        output_sink_atomic(int fd, std::pmr::memory_resource* resource): output_sink_atomic(fd, false, resource) {}
+
+        explicit output_sink_atomic(std::pmr::memory_resource* resource): output_sink_atomic(STDOUT_FILENO, false, resource) {}
+
+        static constexpr std::size_t max_message_size() {
+            return PIPE_BUF;
+        }
+
+        void done() {
+            std::string_view messages = m_buffer;
+            while (!messages.empty()) {
+                // As many whole messages as fit into PIPE_BUF, or a single oversized one
+                std::size_t size = message_end(messages, 0);
+                if (size > PIPE_BUF) {
+                    m_oversized.fetch_add(1, std::memory_order_relaxed);
+                } else {
+                    for (std::size_t next; size < messages.size() && (next = message_end(messages, size)) <= PIPE_BUF;)
+                        size = next;
+                }
+
+                if (!internal::write_all(m_fd, messages.data(), size))
+                    m_errors.fetch_add(1, std::memory_order_relaxed);
+                messages.remove_prefix(size);
+            }
+            m_buffer.clear();
+        }
+
+        /**
+         * Number of messages of all atomic sinks written with more than PIPE_BUF bytes
+         */
+        static std::size_t oversized() {
+            return m_oversized.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Number of writes of all atomic sinks that failed
+         */
+        static std::size_t errors() {
+            return m_errors.load(std::memory_order_relaxed);
+        }
+
+    private:
+        int m_fd;
+        std::pmr::string m_buffer;
+
+        static inline std::atomic<std::size_t> m_oversized{0};
+        static inline std::atomic<std::size_t> m_errors{0};
+
+        /**
+         * End of the message starting at start, after its newline
+         */
+        static std::size_t message_end(std::string_view messages, std::size_t start) {
+            std::size_t newline = messages.find('\n', start);
+            return newline == std::string_view::npos ? messages.size() : newline + 1;
+        }
+    };
+
+    /**
+     * Collects the messages of many loggers, from any thread, and writes them to a file descriptor in batches with
+     * a single write. A batch is written once it holds max_bytes, once it holds max_documents messages or after
+     * max_delay, whichever comes first.
+     *
+     * Appending reserves space in the current buffer with an atomic add and copies the message, it takes no lock.
+     * A thread of its own writes the full buffer while appends go to the second one. The append that fills a
+     * buffer wakes it with an atomic flag and a semaphore, only flush() and the destructor take the mutex.
+     */
+    class batch_writer {
+    public:
+        explicit batch_writer(int fd = STDOUT_FILENO, std::size_t max_bytes = 1 << 16, std::size_t max_documents = 256,
+                              std::chrono::milliseconds max_delay = std::chrono::milliseconds(100))
+            : m_fd{fd}, m_max_bytes{max_bytes}, m_max_documents{max_documents}, m_max_delay{max_delay},
+              m_buffers{buffer(max_bytes), buffer(max_bytes)}, m_thread([this] { run(); }) {}
+
+        batch_writer(const batch_writer&) = delete;
+        batch_writer& operator=(const batch_writer&) = delete;
+
+        ~batch_writer() {
+            {
+                std::lock_guard lock(m_mutex);
+                m_stop = true;
+            }
+            m_signal.release();
+            m_thread.join();
+        }
+
+        /**
+         * The batch writer of the process, writing to stdout
+         */
+        static batch_writer& standard() {
+            static batch_writer writer;
+            return writer;
+        }
+
+        /**
+         * Adds message to the current batch. Messages larger than max_bytes are written right away, after the
+         * batches before them.
+         */
+        void append(std::string_view message) {
+            if (message.size() > m_max_bytes) {
+                std::lock_guard lock(m_large_mutex);
+                flush();
+                if (!internal::write_all(m_fd, message.data(), message.size()))
+                    m_errors.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+
+            while (true) {
+                std::uint64_t generation = m_generation.load(std::memory_order_acquire);
+                auto& current = m_buffers[generation % 2];
+
+                std::size_t offset = current.reserved.fetch_add(message.size(), std::memory_order_acq_rel);
+                if (offset + message.size() <= m_max_bytes) {
+                    std::memcpy(current.data.get() + offset, message.data(), message.size());
+                    current.committed.fetch_add(message.size(), std::memory_order_release);
+
+                    std::size_t documents = current.documents.fetch_add(1, std::memory_order_relaxed) + 1;
+                    if (documents == m_max_documents || offset + message.size() == m_max_bytes)
+                        request_write();
+                    return;
+                }
+
+                // The first reservation past the end seals the buffer, the ones after it wait for the next buffer
+                if (offset <= m_max_bytes) {
+                    current.length.store(offset, std::memory_order_release);
+                    request_write();
+                }
+                m_generation.wait(generation, std::memory_order_acquire);
+            }
+        }
+
+        /**
+         * Writes everything appended so far and waits until it is written
+         */
+        void flush() {
+            std::unique_lock lock(m_mutex);
+            std::uint64_t ticket = ++m_flush_requests;
+            m_signal.release();
+            m_flushed.wait(lock, [&] { return m_flushes >= ticket || m_stop; });
+        }
+
+        /**
+         * Number of writes of batches and large messages that failed
+         */
+        std::size_t errors() const {
+            return m_errors.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Number of batches written
+         */
+        std::size_t batches() const {
+            return m_batches.load(std::memory_order_relaxed);
+        }
+
+    private:
+        static constexpr std::size_t no_length = std::numeric_limits<std::size_t>::max();
+
+        struct alignas(internal::cache_line_size) buffer {
+            explicit buffer(std::size_t size): data{new char[size]} {}
+
+            std::unique_ptr<char[]> data;
+            std::atomic<std::size_t> reserved{0};
+            std::atomic<std::size_t> committed{0};
+            std::atomic<std::size_t> documents{0};
+            std::atomic<std::size_t> length{no_length};
+        };
+
+        int m_fd;
+        std::size_t m_max_bytes;
+        std::size_t m_max_documents;
+        std::chrono::milliseconds m_max_delay;
+
+        std::array<buffer, 2> m_buffers;
+        // Counts the buffer switches, the active buffer is the generation modulo 2
+        alignas(internal::cache_line_size) std::atomic<std::uint64_t> m_generation{0};
+        std::atomic<std::size_t> m_errors{0};
+        std::atomic<std::size_t> m_batches{0};
+
+        // Set by the append that fills a buffer, only the first one after a write releases the semaphore
+        alignas(internal::cache_line_size) std::atomic<bool> m_write_requested{false};
+        std::counting_semaphore<> m_signal{0};
+
+        std::mutex m_mutex;
+        std::mutex m_large_mutex;
+        std::condition_variable m_flushed;
+        bool m_stop{false};
+        std::uint64_t m_flush_requests{0};
+        std::uint64_t m_flushes{0};
+
+        std::thread m_thread;
+
+        void request_write() {
+            if (!m_write_requested.exchange(true, std::memory_order_acq_rel))
+                m_signal.release();
+        }
+
+        void run() {
+            while (true) {
+                // Flush and stop release the semaphore as well, extra releases only make an empty round
+                (void) m_signal.try_acquire_for(m_max_delay);
+                m_write_requested.store(false, std::memory_order_release);
+
+                std::unique_lock lock(m_mutex);
+                bool stop = m_stop;
+                std::uint64_t flush_requests = m_flush_requests;
+                lock.unlock();
+
+                // Appends that saw the previous buffer as active may have gone into the other one, write both. An
+                // append that was late for its buffer can also seal it while inactive, the appends that find it
+                // active again then wait for it to be written.
+                write_active();
+                write_active();
+                while (m_buffers[m_generation.load(std::memory_order_acquire) % 2].reserved.load(
+                        std::memory_order_acquire) > m_max_bytes)
+                    write_active();
+
+                lock.lock();
+                m_flushes = flush_requests;
+                m_flushed.notify_all();
+                if (stop)
+                    return;
+            }
+        }
+
+        /**
+         * Seals the active buffer, makes the other one active and writes the sealed one
+         */
+        void write_active() {
+            std::uint64_t generation = m_generation.load(std::memory_order_relaxed);
+            auto& current = m_buffers[generation % 2];
+
+            if (current.reserved.load(std::memory_order_acquire) == 0)
+                return;
+
+            // Exactly one reservation moves reserved past the end, its offset is the length of the batch
+            std::size_t reserved = current.reserved.fetch_add(m_max_bytes + 1, std::memory_order_acq_rel);
+            if (reserved <= m_max_bytes)
+                current.length.store(reserved, std::memory_order_release);
+
+            m_generation.store(generation + 1, std::memory_order_release);
+            m_generation.notify_all();
+
+            std::size_t length;
+            while ((length = current.length.load(std::memory_order_acquire)) == no_length)
+                std::this_thread::yield();
+            while (current.committed.load(std::memory_order_acquire) != length)
+                std::this_thread::yield();
+
+            if (length > 0) {
+                if (!internal::write_all(m_fd, current.data.get(), length))
+                    m_errors.fetch_add(1, std::memory_order_relaxed);
+                m_batches.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            current.length.store(no_length, std::memory_order_relaxed);
+            current.documents.store(0, std::memory_order_relaxed);
+            current.committed.store(0, std::memory_order_relaxed);
+            current.reserved.store(0, std::memory_order_release);
+        }
+    };
+
+    /**
+     * Sink appending its messages to a batch_writer, by default the one of the process writing to stdout
+     */
+    class output_sink_batch: public output_sink_pmr_string {
+    public:
+        output_sink_batch(batch_writer& writer = batch_writer::standard(), bool validate_utf8 = false,
+                          std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+            : output_sink_pmr_string(m_buffer, validate_utf8), m_writer{writer}, m_buffer{resource} {}
+
+        output_sink_batch(batch_writer& writer, std::pmr::memory_resource* resource): output_sink_batch(writer, false, resource) {}
+
+        explicit output_sink_batch(std::pmr::memory_resource* resource): output_sink_batch(batch_writer::standard(), false, resource) {}
+
+        void done() {
+            m_writer.append(m_buffer);
+            m_buffer.clear();
+        }
+
+    private:
+        batch_writer& m_writer;
+        std::pmr::string m_buffer;
+    };
+
+    /**
+     * Writes messages to a file descriptor through io_uring, from buffers registered with the kernel once. Appending
+     * copies the message into the current buffer and, unless writes are already in flight, submits everything not
+     * written yet without waiting: one write per buffer, linked with IOSQE_IO_LINK so they are written in order and
+     * a short or failed write cancels the ones after it, which are submitted again. Completions are reaped when
+     * appending and flushing, all that are ready at once. What is appended while writes are in flight goes out with
+     * the next chain, once they completed, so several buffers are in flight when they filled up meanwhile. Appending
+     * only waits when all buffers are taken.
+     *
+     * The last messages are written once the next message is appended, with flush() or when the writer is destroyed.
+     * When io_uring is not available, because of the kernel, its settings or the platform, every append writes the
+     * message with write. Like async_writer, a uring_writer is used from one thread.
+     */
+    class uring_writer {
+    public:
+        explicit uring_writer(int fd = STDOUT_FILENO, std::size_t buffer_size = 1 << 16, unsigned buffers = 4)
+            : m_fd{fd}, m_buffer_size{buffer_size}, m_data{new char[buffer_size * buffers]}, m_buffers(buffers)
+#if CW_EMF_URING
+            , m_uring{std::max(8u, buffers)}
+#endif
+        {
+#if CW_EMF_URING
+            if (m_uring.valid()) {
+                std::vector<::iovec> iov;
+                for (unsigned i=0; i < buffers; ++i)
+                    iov.push_back({m_data.get() + i * buffer_size, buffer_size});
+                m_registered = m_uring.register_buffers(iov.data(), buffers);
+                // Before 5.6 an offset of -1 does not mean the current position, files are written with write there
+                if (!(m_uring.features() & IORING_FEAT_RW_CUR_POS) && ::lseek(fd, 0, SEEK_CUR) >= 0)
+                    m_failed = true;
+                // IORING_OP_WRITE_FIXED and IORING_OP_WRITEV came with io_uring, IORING_OP_WRITE only with 5.6
+                m_opcode = m_registered ? IORING_OP_WRITE_FIXED
+                         : m_uring.supports(IORING_OP_WRITE) ? IORING_OP_WRITE : IORING_OP_WRITEV;
+            }
+#endif
+        }
+
+        uring_writer(const uring_writer&) = delete;
+        uring_writer& operator=(const uring_writer&) = delete;
+
+        ~uring_writer() {
+            flush();
+        }
+
+        void append(std::string_view message) {
+            if (!uses_uring()) {
+                ++m_system_calls;
+                if (!internal::write_all(m_fd, message.data(), message.size()))
+                    ++m_errors;
+                return;
+            }
+
+            reap(false);
+            while (!message.empty()) {
+                if (m_buffers[m_filling].size == m_buffer_size)
+                    next_buffer();
+
+                auto& current = m_buffers[m_filling];
+                std::size_t size = std::min(message.size(), m_buffer_size - current.size);
+                std::memcpy(data(m_filling) + current.size, message.data(), size);
+                current.size += size;
+                message.remove_prefix(size);
+            }
+            if (m_in_flight == 0)
+                submit();
+        }
+
+        /**
+         * Writes everything appended so far and waits until it is written
+         */
+        void flush() {
+            while (m_in_flight > 0 || unwritten())
+                if (m_in_flight > 0)
+                    reap(true);
+                else
+                    submit();
+        }
+
+        /**
+         * Whether writes go through io_uring
+         */
+        bool uses_uring() const {
+#if CW_EMF_URING
+            return m_uring.valid() && !m_failed;
+#else
+            return false;
+#endif
+        }
+
+        /**
+         * Whether the buffers are registered with the kernel, writes use IORING_OP_WRITE_FIXED then
+         */
+        bool registered() const {
+            return m_registered;
+        }
+
+#if CW_EMF_URING
+        /**
+         * The opcode of the writes: IORING_OP_WRITE_FIXED, IORING_OP_WRITE or, on kernels before 5.6,
+         * IORING_OP_WRITEV
+         */
+        unsigned opcode() const {
+            return m_opcode;
+        }
+#endif
+
+        /**
+         * Number of system calls made for writing, io_uring_enter or write
+         */
+        std::size_t system_calls() const {
+            return m_system_calls;
+        }
+
+        /**
+         * Number of writes that failed, their messages are lost
+         */
+        std::size_t errors() const {
+            return m_errors;
+        }
+
+    private:
+        struct buffer {
+            std::size_t size{0};        // bytes appended
+            std::size_t written{0};     // bytes written, from the start
+            std::size_t submitted{0};   // end of the write in flight
+            bool in_flight{false};
+#if CW_EMF_URING
+            ::iovec iov{};              // read by IORING_OP_WRITEV until its completion
+#endif
+        };
+
+        int m_fd;
+        std::size_t m_buffer_size;
+        std::unique_ptr<char[]> m_data;
+        std::vector<buffer> m_buffers;
+#if CW_EMF_URING
+        internal::uring m_uring;
+        unsigned m_opcode{IORING_OP_WRITEV};
+#endif
+        bool m_registered{false};
+        bool m_failed{false};
+
+        // The buffers from m_head to m_filling, in ring order, hold messages not written yet
+        std::size_t m_head{0};
+        std::size_t m_filling{0};
+        std::size_t m_in_flight{0};     // writes submitted and not completed
+
+        std::size_t m_system_calls{0};
+        std::size_t m_errors{0};
+
+        char* data(std::size_t index) const {
+            return m_data.get() + index * m_buffer_size;
+        }
+
+        bool unwritten() const {
+            return m_buffers[m_head].written < m_buffers[m_head].size;
+        }
+
+        /**
+         * Moves on to the next buffer, waiting for the write of the oldest one when all are taken
+         */
+        void next_buffer() {
+            std::size_t next = (m_filling + 1) % m_buffers.size();
+            while (next == m_head && m_buffers[m_head].size > 0) {
+                if (m_in_flight > 0)
+                    reap(true);
+                else
+                    submit();
+            }
+            // All buffers may have been written while waiting, the one filling is free again then
+            if (m_buffers[m_filling].size > 0)
+                m_filling = next;
+        }
+
+        /**
+         * Submits a chain of writes of everything unwritten, one per buffer from the head on
+         */
+        void submit() {
+#if CW_EMF_URING
+            if (m_failed) {
+                fall_back();
+                return;
+            }
+
+            // Entries an interrupted io_uring_enter left behind take up the queue, submitting them makes room for
+            // the whole chain. A chain split across submissions would not be ordered.
+            while (m_uring.free_entries() < m_buffers.size()) {
+                ++m_system_calls;
+                if (int result = m_uring.enter(); result < 0 && !retry(result)) {
+                    fall_back();
+                    return;
+                }
+            }
+
+            ::io_uring_sqe* previous = nullptr;
+            for (std::size_t index = m_head;; index = (index + 1) % m_buffers.size()) {
+                auto& current = m_buffers[index];
+                if (current.written < current.size) {
+                    if (previous)
+                        previous->flags |= IOSQE_IO_LINK;
+                    previous = prepare_write(index);
+                }
+                if (index == m_filling)
+                    break;
+            }
+            if (!previous)
+                return;
+
+            // Interrupted submissions are retried when reaping
+            ++m_system_calls;
+            if (int result = m_uring.enter(); result < 0 && !retry(result))
+                fall_back();
+#endif
+        }
+
+#if CW_EMF_URING
+        ::io_uring_sqe* prepare_write(std::size_t index) {
+            auto& current = m_buffers[index];
+            ::io_uring_sqe* sqe = m_uring.next_sqe();
+            sqe->opcode = static_cast<std::uint8_t>(m_opcode);
+            sqe->fd = m_fd;
+            sqe->off = static_cast<std::uint64_t>(-1);   // the current file position
+            sqe->user_data = index;
+            if (m_opcode == IORING_OP_WRITEV) {
+                current.iov = {data(index) + current.written, current.size - current.written};
+                sqe->addr = reinterpret_cast<std::uint64_t>(&current.iov);
+                sqe->len = 1;
+            } else {
+                sqe->addr = reinterpret_cast<std::uint64_t>(data(index) + current.written);
+                sqe->len = static_cast<std::uint32_t>(current.size - current.written);
+                if (m_opcode == IORING_OP_WRITE_FIXED)
+                    sqe->buf_index = static_cast<std::uint16_t>(index);
+            }
+
+            current.in_flight = true;
+            current.submitted = current.size;
+            ++m_in_flight;
+            return sqe;
+        }
+#endif
+
+        /**
+         * Handles the completions of the writes in flight, waiting for one with wait set. Submissions an
+         * interrupted io_uring_enter left behind are submitted again either way.
+         */
+        void reap(bool wait) {
+#if CW_EMF_URING
+            if (m_in_flight == 0)
+                return;
+
+            if (wait || m_uring.unsubmitted() > 0) {
+                ++m_system_calls;
+                if (int result = m_uring.enter(wait ? 1 : 0); result < 0 && !retry(result)) {
+                    fall_back();
+                    return;
+                }
+            }
+
+            m_uring.reap([this](const ::io_uring_cqe& cqe) {
+                auto& current = m_buffers[cqe.user_data];
+                current.in_flight = false;
+                --m_in_flight;
+                // A write cancelled after a short or failed one in its chain, or interrupted, is submitted again
+                if (cqe.res >= 0) {
+                    current.written += cqe.res;
+                } else if (cqe.res != -ECANCELED && !retry(cqe.res)) {
+                    ++m_errors;
+                    current.written = current.submitted;
+                }
+            });
+
+            // The rest of a short write and what was appended meanwhile go out right away
+            if (m_in_flight == 0) {
+                release_head();
+                if (unwritten())
+                    submit();
+            }
+#endif
+        }
+
+        /**
+         * Frees the buffers from the head on that are written, the last one is reused right away when it is also
+         * the one filling
+         */
+        void release_head() {
+            while (true) {
+                auto& head = m_buffers[m_head];
+                if (head.in_flight || head.written < head.size)
+                    return;
+                head = {};
+                if (m_head == m_filling)
+                    return;
+                m_head = (m_head + 1) % m_buffers.size();
+            }
+        }
+
+        static bool retry(int error) {
+            return error == -EINTR || error == -EAGAIN || error == -EBUSY;
+        }
+
+        /**
+         * Stops using io_uring after io_uring_enter failed, what was not written yet is written with write
+         */
+        void fall_back() {
+            m_failed = true;
+            m_in_flight = 0;
+            for (std::size_t index = m_head;; index = (index + 1) % m_buffers.size()) {
+                auto& current = m_buffers[index];
+                current.in_flight = false;
+                if (current.written < current.size) {
+                    ++m_system_calls;
+                    if (!internal::write_all(m_fd, data(index) + current.written, current.size - current.written))
+                        ++m_errors;
+                    current.written = current.size;
+                }
+                if (index == m_filling)
+                    break;
+            }
+            release_head();
+        }
+    };
+
+    /**
+     * Sink appending its messages to a uring_writer
+     */
+    class output_sink_uring: public output_sink_pmr_string {
+    public:
+        output_sink_uring(uring_writer& writer, bool validate_utf8 = false,
+                          std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+            : output_sink_pmr_string(m_buffer, validate_utf8), m_writer{writer}, m_buffer{resource} {}
+
+        output_sink_uring(uring_writer& writer, std::pmr::memory_resource* resource): output_sink_uring(writer, false, resource) {}
+
+        void done() {
+            m_writer.append(m_buffer);
+            m_buffer.clear();
+        }
+
+    private:
+        uring_writer& m_writer;
+        std::pmr::string m_buffer;
+    };
+
+    /**
+     * Hands messages to a pipe with vmsplice, which maps the pages holding them into the pipe instead of copying
+     * them. output_sink_vmsplice renders its messages straight into page aligned buffers of the writer, taken from
+     * resource(), so a message is not copied at all before the reader of the pipe reads it.
+     *
+     * The pipe refers to the pages of a buffer until the reader consumed them, a buffer is only handed out again
+     * once the bytes in the pipe, FIONREAD, show the reader is past its end. With the default two buffers one is
+     * being filled while the other one is read. When no buffer is free the sink renders into memory from the
+     * upstream resource and the message is written with write, as it is when fd is not a pipe or not on Linux.
+     * A reader that uses tee, or splice into another pipe, keeps referring to the pages after it read them and must
+     * not be used with this writer.
+     *
+     * Like async_writer, a vmsplice_writer is used from one thread. It has to outlive its sinks.
+     */
+    class vmsplice_writer {
+    public:
+        explicit vmsplice_writer(int fd = STDOUT_FILENO, std::size_t buffer_size = 1 << 16, unsigned buffers = 2,
+                                 std::pmr::memory_resource* upstream = std::pmr::get_default_resource())
+            : m_fd{fd}, m_pages{*this, upstream} {
+#if defined(__linux__)
+            struct stat status{};
+            if (::fstat(fd, &status) != 0 || !S_ISFIFO(status.st_mode))
+                return;
+
+            std::size_t page_size = ::sysconf(_SC_PAGESIZE);
+            m_buffer_size = (buffer_size + page_size - 1) / page_size * page_size;
+            void* data = ::mmap(nullptr, m_buffer_size * buffers, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (data == MAP_FAILED)
+                return;
+
+            m_data = static_cast<char*>(data);
+            m_buffers.resize(buffers);
+#endif
+        }
+
+        vmsplice_writer(const vmsplice_writer&) = delete;
+        vmsplice_writer& operator=(const vmsplice_writer&) = delete;
+
+        ~vmsplice_writer() {
+#if defined(__linux__)
+            if (m_data)
+                ::munmap(m_data, m_buffer_size * m_buffers.size());
+#endif
+        }
+
+        /**
+         * Memory for the messages of the sinks, a page aligned buffer while one is free
+         */
+        std::pmr::memory_resource* resource() {
+            return &m_pages;
+        }
+
+        /**
+         * Size of a string that fits into a buffer, or 0 when none is free and sinks should not reserve one
+         */
+        std::size_t available() {
+            return next_free() < m_buffers.size() ? m_buffer_size - 1 : 0;
+        }
+
+        /**
+         * Splices message into the pipe when it lies in one of the buffers, writes it otherwise. The buffer must not
+         * be changed afterwards, the sink gives it back to resource() right away.
+         */
+        void write(std::string_view message) {
+            std::size_t index = buffer_of(message.data());
+#if defined(__linux__)
+            if (index < m_buffers.size()) {
+                ::iovec iov{const_cast<char*>(message.data()), message.size()};
+                while (iov.iov_len > 0) {
+                    ssize_t spliced = ::vmsplice(m_fd, &iov, 1, 0);
+                    if (spliced < 0) {
+                        if (errno == EINTR)
+                            continue;
+                        break;
+                    }
+                    iov.iov_base = static_cast<char*>(iov.iov_base) + spliced;
+                    iov.iov_len -= spliced;
+                    m_bytes_spliced += spliced;
+                    m_total += spliced;
+                }
+                m_buffers[index] = {state::in_pipe, m_total};
+                message.remove_prefix(message.size() - iov.iov_len);
+            }
+#endif
+            if (!message.empty()) {
+                std::size_t written;
+                if (!internal::write_all(m_fd, message.data(), message.size(), written))
+                    ++m_errors;
+                // Only what reached the pipe, or next_free() would take more as consumed than the reader read
+                m_bytes_written += written;
+                m_total += written;
+            }
+        }
+
+        /**
+         * Whether the messages go to a pipe with vmsplice
+         */
+        bool uses_vmsplice() const {
+            return !m_buffers.empty();
+        }
+
+        /**
+         * Bytes mapped into the pipe without a copy
+         */
+        std::size_t bytes_spliced() const {
+            return m_bytes_spliced;
+        }
+
+        /**
+         * Bytes copied into the pipe or file with write
+         */
+        std::size_t bytes_written() const {
+            return m_bytes_written;
+        }
+
+        /**
+         * Number of writes that failed
+         */
+        std::size_t errors() const {
+            return m_errors;
+        }
+
+    private:
+        enum class state {
+            free,       // not in use
+            lent,       // taken from resource(), being rendered into
+            in_pipe     // spliced, the pipe refers to it until the reader is past end
+        };
+
+        struct buffer {
+            state status{state::free};
+            std::size_t end{0};     // m_total after the buffer was spliced
+        };
+
+        /**
+         * Lends the buffers to strings that fit into one, everything else comes from upstream
+         */
+        class pages: public std::pmr::memory_resource {
+        public:
+            pages(vmsplice_writer& writer, std::pmr::memory_resource* upstream): m_writer{writer}, m_upstream{upstream} {}
+
+        private:
+            vmsplice_writer& m_writer;
+            std::pmr::memory_resource* m_upstream;
+
+            void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+                if (bytes <= m_writer.m_buffer_size) {
+                    std::size_t index = m_writer.next_free();
+                    if (index < m_writer.m_buffers.size()) {
+                        m_writer.m_buffers[index].status = state::lent;
+                        return m_writer.m_data + index * m_writer.m_buffer_size;
+                    }
+                }
+                return m_upstream->allocate(bytes, alignment);
+            }
+
+            void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override {
+                std::size_t index = m_writer.buffer_of(static_cast<char*>(p));
+                if (index == m_writer.m_buffers.size())
+                    m_upstream->deallocate(p, bytes, alignment);
+                else if (m_writer.m_buffers[index].status == state::lent)
+                    m_writer.m_buffers[index].status = state::free;
+            }
+
+            bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+                return this == &other;
+            }
+        };
+
+        int m_fd;
+        std::size_t m_buffer_size{0};
+        char* m_data{nullptr};
+        std::vector<buffer> m_buffers;
+        pages m_pages;
+
+        std::size_t m_total{0};     // bytes that reached the pipe
+        std::size_t m_bytes_spliced{0};
+        std::size_t m_bytes_written{0};
+        std::size_t m_errors{0};
+
+        std::size_t buffer_of(const char* p) const {
+            if (m_data == nullptr || p < m_data || p >= m_data + m_buffer_size * m_buffers.size())
+                return m_buffers.size();
+            return (p - m_data) / m_buffer_size;
+        }
+
+        /**
+         * Index of a buffer that can be handed out, the number of buffers when there is none
+         */
+        std::size_t next_free() {
+            std::size_t consumed = 0;
+            bool consumed_known = false;
+            for (std::size_t i=0; i < m_buffers.size(); ++i) {
+                if (m_buffers[i].status == state::free)
+                    return i;
+                if (m_buffers[i].status != state::in_pipe)
+                    continue;
+
+                if (!consumed_known) {
+                    int unread = 0;
+#if defined(__linux__)
+                    if (::ioctl(m_fd, FIONREAD, &unread) != 0)
+                        return m_buffers.size();
+#endif
+                    // Bytes written by others into the same pipe only make this smaller, never too large
+                    consumed = m_total - std::min<std::size_t>(unread, m_total);
+                    consumed_known = true;
+                }
+                if (consumed >= m_buffers[i].end) {
+                    m_buffers[i].status = state::free;
+                    return i;
+                }
+            }
+            return m_buffers.size();
+        }
+    };
+
+    /**
+     * Sink rendering into the buffers of a vmsplice_writer and splicing its messages into the pipe
+     */
+    class output_sink_vmsplice: public output_sink_pmr_string {
+    public:
+        output_sink_vmsplice(vmsplice_writer& writer, bool validate_utf8 = false)
+            : output_sink_pmr_string(m_buffer, validate_utf8), m_writer{writer}, m_buffer{writer.resource()} {
+            reserve();
+        }
+
+        void done() {
+            m_writer.write(m_buffer);
+            // Gives the spliced buffer back, the string must not touch it anymore
+            std::pmr::string(m_buffer.get_allocator()).swap(m_buffer);
+            reserve();
+        }
+
+    private:
+        vmsplice_writer& m_writer;
+        std::pmr::string m_buffer;
+
+        void reserve() {
+            if (std::size_t size = m_writer.available())
+                m_buffer.reserve(size);
+        }
+    };
+
+    /**
+     * A datagram socket with its destination, the UDP or Unix socket the CloudWatch agent listens on for EMF.
+     * Sending takes no lock, any number of sinks on any thread can share one socket.
+     */
+    class datagram_socket {
+    public:
+        /**
+         * Socket sending to a UDP port, host is a numeric IPv4 or IPv6 address
+         */
+        static datagram_socket udp(const std::string& host = "127.0.0.1", std::uint16_t port = 25888) {
+            ::sockaddr_storage address{};
+            ::socklen_t length = internal::ip_address(host, port, address);
+            return datagram_socket(address, length);
+        }
+
+        /**
+         * Socket sending to a Unix datagram socket bound to path
+         */
+        static datagram_socket unix_dgram(const std::string& path) {
+            ::sockaddr_storage address{};
+            auto* un = reinterpret_cast<::sockaddr_un*>(&address);
+            if (path.size() >= sizeof(un->sun_path))
+                throw std::invalid_argument("datagram_socket: path too long: " + path);
+            un->sun_family = AF_UNIX;
+            std::memcpy(un->sun_path, path.c_str(), path.size() + 1);
+            return datagram_socket(address, static_cast<::socklen_t>(offsetof(::sockaddr_un, sun_path) + path.size() + 1));
+        }
+
+        /**
+         * The socket of the process sending to the default EMF port of the CloudWatch agent, udp://127.0.0.1:25888
+         */
+        static datagram_socket& agent() {
+            static datagram_socket socket = udp();
+            return socket;
+        }
+
+        datagram_socket(datagram_socket&& other) noexcept
+            : m_fd{std::exchange(other.m_fd, -1)}, m_address{other.m_address}, m_address_length{other.m_address_length} {}
+
+        datagram_socket& operator=(datagram_socket&&) = delete;
+
+        ~datagram_socket() {
+            if (m_fd >= 0)
+                ::close(m_fd);
+        }
+
+        /**
+         * Sends every message as a datagram of its own, with as few system calls as sendmmsg allows
+         */
+        void send(const std::string_view* messages, std::size_t count) {
+#if defined(__linux__)
+            constexpr std::size_t batch = 64;
+            std::array<::iovec, batch> iov;
+            std::array<::mmsghdr, batch> headers;
+
+            while (count > 0) {
+                std::size_t size = std::min(count, batch);
+                for (std::size_t i=0; i < size; ++i) {
+                    iov[i] = {const_cast<char*>(messages[i].data()), messages[i].size()};
+                    headers[i] = {};
+                    headers[i].msg_hdr.msg_name = &m_address;
+                    headers[i].msg_hdr.msg_namelen = m_address_length;
+                    headers[i].msg_hdr.msg_iov = &iov[i];
+                    headers[i].msg_hdr.msg_iovlen = 1;
+                }
+
+                m_system_calls.fetch_add(1, std::memory_order_relaxed);
+                int sent = ::sendmmsg(m_fd, headers.data(), static_cast<unsigned>(size), 0);
+                if (sent < 0) {
+                    if (errno == EINTR)
+                        continue;
+                    // The first message failed, skip it and go on with the rest
+                    m_errors.fetch_add(1, std::memory_order_relaxed);
+                    sent = 1;
+                } else {
+                    m_datagrams.fetch_add(sent, std::memory_order_relaxed);
+                }
+                messages += sent;
+                count -= sent;
+            }
+#else
+            for (std::size_t i=0; i < count; ++i) {
+                m_system_calls.fetch_add(1, std::memory_order_relaxed);
+                ssize_t sent;
+                while ((sent = ::sendto(m_fd, messages[i].data(), messages[i].size(), 0,
+                                        reinterpret_cast<const ::sockaddr*>(&m_address), m_address_length)) < 0 && errno == EINTR);
+                if (sent < 0)
+                    m_errors.fetch_add(1, std::memory_order_relaxed);
+                else
+                    m_datagrams.fetch_add(1, std::memory_order_relaxed);
+            }
+#endif
+        }
+
+        /**
+         * Number of datagrams sent
+         */
+        std::size_t datagrams() const {
+            return m_datagrams.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Number of messages that could not be sent, for example because nobody listens on a Unix socket
+         */
+        std::size_t errors() const {
+            return m_errors.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Number of sendmmsg calls, or sendto where there is no sendmmsg
+         */
+        std::size_t system_calls() const {
+            return m_system_calls.load(std::memory_order_relaxed);
+        }
+
+    private:
+        int m_fd;
+        ::sockaddr_storage m_address;
+        ::socklen_t m_address_length;
+
+        std::atomic<std::size_t> m_datagrams{0};
+        std::atomic<std::size_t> m_errors{0};
+        std::atomic<std::size_t> m_system_calls{0};
+
+        datagram_socket(const ::sockaddr_storage& address, ::socklen_t length)
+            : m_fd{::socket(address.ss_family, SOCK_DGRAM | SOCK_CLOEXEC, 0)}, m_address{address}, m_address_length{length} {
+            if (m_fd < 0)
+                throw std::system_error(errno, std::generic_category(), "datagram_socket: socket");
+        }
+    };
+
+    /**
+     * Sink sending each EMF message as a datagram of at most max_size bytes, the messages of one flush with one
+     * sendmmsg. The logger writes fewer values per message until they fit, messages too large even then are
+     * dropped by the socket and counted in its errors().
+     */
+    template<std::size_t max_size>
+    class basic_output_sink_datagram: public output_sink_pmr_string {
+    public:
+        basic_output_sink_datagram(datagram_socket& socket, bool validate_utf8 = false,
+                                   std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+            : output_sink_pmr_string(m_buffer, validate_utf8), m_socket{socket}, m_buffer{resource} {}
+
+        basic_output_sink_datagram(datagram_socket& socket, std::pmr::memory_resource* resource)
+            : basic_output_sink_datagram(socket, false, resource) {}
+
+        static constexpr std::size_t max_message_size() {
+            return max_size;
+        }
+
+        void done() {
+            // Messages end with a newline, which is sent with them
+            internal::small_vector<std::string_view, 8> messages;
+            std::string_view buffer = m_buffer;
+            for (std::size_t end; (end = buffer.find('\n')) != std::string_view::npos; buffer.remove_prefix(end + 1))
+                messages.push_back(buffer.substr(0, end + 1));
+
+            m_socket.send(messages.data(), messages.size());
+            m_buffer.clear();
+        }
+
+    private:
+        datagram_socket& m_socket;
+        std::pmr::string m_buffer;
+    };
+
+    /**
+     * Sink sending to the CloudWatch agent over UDP, by default to udp://127.0.0.1:25888. The limit is the largest
+     * UDP payload over IPv4.
+     */
+    class output_sink_udp: public basic_output_sink_datagram<65507> {
+    public:
+        using basic_output_sink_datagram::basic_output_sink_datagram;
+
+        explicit output_sink_udp(std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+            : basic_output_sink_datagram(datagram_socket::agent(), false, resource) {}
+    };
+
+    /**
+     * Sink sending to a Unix datagram socket
+     */
+    using output_sink_unix_dgram = basic_output_sink_datagram<65536>;
+
+    /**
+     * Sends messages over a persistent TCP connection, by default to the EMF endpoint of the CloudWatch agent,
+     * tcp://127.0.0.1:25888. Appending copies the message into a queue of at most capacity bytes and returns, a
+     * thread of its own connects and sends with non-blocking I/O. Messages that do not fit into the queue, for
+     * example while the agent is away, are dropped and counted.
+     *
+     * When the connection is lost, the message it broke off in is dropped and the thread connects again, waiting
+     * from min_backoff up to max_backoff between attempts. Any number of threads can append, they only share a
+     * mutex that the sending thread holds to take the whole queue at once. The destructor waits up to a second for
+     * the queue to be sent.
+     */
+    class tcp_writer {
+    public:
+        explicit tcp_writer(const std::string& host = "127.0.0.1", std::uint16_t port = 25888, std::size_t capacity = 1 << 20,
+                            std::chrono::milliseconds min_backoff = std::chrono::milliseconds(100),
+                            std::chrono::milliseconds max_backoff = std::chrono::seconds(10))
+            : m_address_length{internal::ip_address(host, port, m_address)}, m_capacity{capacity},
+              m_min_backoff{min_backoff}, m_max_backoff{max_backoff}, m_thread([this] { run(); }) {}
+
+        tcp_writer(const tcp_writer&) = delete;
+        tcp_writer& operator=(const tcp_writer&) = delete;
+
+        ~tcp_writer() {
+            flush(std::chrono::seconds(1));
+            {
+                std::lock_guard lock(m_mutex);
+                m_stop = true;
+            }
+            m_wake.notify_one();
+            m_thread.join();
+        }
+
+        /**
+         * The writer of the process, sending to tcp://127.0.0.1:25888
+         */
+        static tcp_writer& agent() {
+            static tcp_writer writer;
+            return writer;
+        }
+
+        /**
+         * Queues message, or drops it when the queue is full. message is one or more newline terminated documents.
+         */
+        void append(std::string_view message) {
+            {
+                std::lock_guard lock(m_mutex);
+                if (m_queue.size() + message.size() <= m_capacity) {
+                    m_queue += message;
+                    m_idle = false;
+                } else {
+                    m_dropped.fetch_add(std::count(message.begin(), message.end(), '\n'), std::memory_order_relaxed);
+                    return;
+                }
+            }
+            m_wake.notify_one();
+        }
+
+        /**
+         * Waits up to timeout until everything appended so far is sent, returns whether it was
+         */
+        bool flush(std::chrono::milliseconds timeout) {
+            std::unique_lock lock(m_mutex);
+            return m_flushed.wait_for(lock, timeout, [this] { return m_idle; });
+        }
+
+        bool connected() const {
+            return m_connected.load(std::memory_order_relaxed);
+        }
+
+        std::size_t bytes_sent() const {
+            return m_bytes_sent.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Number of documents dropped because the queue was full, the connection broke or the writer was destroyed
+         */
+        std::size_t dropped() const {
+            return m_dropped.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Number of connections made after the first one
+         */
+        std::size_t reconnects() const {
+            return m_reconnects.load(std::memory_order_relaxed);
+        }
+
+    private:
+        ::sockaddr_storage m_address{};
+        ::socklen_t m_address_length;
+        std::size_t m_capacity;
+        std::chrono::milliseconds m_min_backoff;
+        std::chrono::milliseconds m_max_backoff;
+
+        std::mutex m_mutex;
+        std::condition_variable m_wake;
+        std::condition_variable m_flushed;
+        std::string m_queue;
+        bool m_idle{true};      // nothing queued and nothing left to send
+        bool m_stop{false};
+
+        std::atomic<bool> m_connected{false};
+        std::atomic<std::size_t> m_bytes_sent{0};
+        std::atomic<std::size_t> m_dropped{0};
+        std::atomic<std::size_t> m_reconnects{0};
+
+        std::thread m_thread;
+
+        static constexpr int poll_timeout_ms = 100;
+
+        void run() {
+            int fd = -1;
+            bool connected_before = false;
+            auto backoff = m_min_backoff;
+            std::string sending;
+            std::size_t sent = 0;
+
+            while (true) {
+                if (fd < 0) {
+                    fd = connect();
+                    if (fd < 0) {
+                        std::unique_lock lock(m_mutex);
+                        if (m_wake.wait_for(lock, backoff, [this] { return m_stop; }))
+                            break;
+                        backoff = std::min(backoff * 2, m_max_backoff);
+                        continue;
+                    }
+                    if (connected_before)
+                        m_reconnects.fetch_add(1, std::memory_order_relaxed);
+                    connected_before = true;
+                    backoff = m_min_backoff;
+                    m_connected.store(true, std::memory_order_relaxed);
+                }
+
+                if (sent == sending.size()) {
+                    sending.clear();
+                    sent = 0;
+
+                    std::unique_lock lock(m_mutex);
+                    if (m_queue.empty()) {
+                        m_idle = true;
+                        m_flushed.notify_all();
+                    }
+                    m_wake.wait_for(lock, std::chrono::milliseconds(poll_timeout_ms), [this] { return !m_queue.empty() || m_stop; });
+                    if (m_stop)
+                        break;
+                    std::swap(sending, m_queue);
+                    continue;
+                }
+
+                ssize_t size = ::send(fd, sending.data() + sent, sending.size() - sent, MSG_NOSIGNAL);
+                if (size >= 0) {
+                    sent += size;
+                    m_bytes_sent.fetch_add(size, std::memory_order_relaxed);
+                } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    ::pollfd writable{fd, POLLOUT, 0};
+                    ::poll(&writable, 1, poll_timeout_ms);
+                    std::lock_guard lock(m_mutex);
+                    if (m_stop)
+                        break;
+                } else if (errno != EINTR) {
+                    // The agent only sees the part of the current document that was sent, the rest is dropped
+                    ::close(fd);
+                    fd = -1;
+                    m_connected.store(false, std::memory_order_relaxed);
+                    if (sent > 0 && sending[sent - 1] != '\n') {
+                        sent = std::min(sending.find('\n', sent), sending.size() - 1) + 1;
+                        m_dropped.fetch_add(1, std::memory_order_relaxed);
+                    }
+                }
+            }
+
+            if (fd >= 0)
+                ::close(fd);
+            m_connected.store(false, std::memory_order_relaxed);
+
+            std::lock_guard lock(m_mutex);
+            m_dropped.fetch_add(std::count(sending.begin() + sent, sending.end(), '\n')
+                                + std::count(m_queue.begin(), m_queue.end(), '\n'), std::memory_order_relaxed);
+        }
+
+        /**
+         * Connects without blocking for longer than a second, returns the socket or -1
+         */
+        int connect() {
+            int fd = ::socket(m_address.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (fd < 0)
+                return -1;
+
+            if (::connect(fd, reinterpret_cast<const ::sockaddr*>(&m_address), m_address_length) != 0) {
+                ::pollfd writable{fd, POLLOUT, 0};
+                int error = 0;
+                ::socklen_t length = sizeof(error);
+                if (errno != EINPROGRESS || ::poll(&writable, 1, 1000) != 1
+                        || ::getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) != 0 || error != 0) {
+                    ::close(fd);
+                    return -1;
+                }
+            }
+
+            // Documents are already sent in batches, Nagle's algorithm would only delay them
+            int no_delay = 1;
+            ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+            return fd;
+        }
+    };
+
+    /**
+     * Sink queueing its messages on a tcp_writer, by default the one of the process sending to the agent
+     */
+    class output_sink_tcp: public output_sink_pmr_string {
+    public:
+        output_sink_tcp(tcp_writer& writer = tcp_writer::agent(), bool validate_utf8 = false,
+                        std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+            : output_sink_pmr_string(m_buffer, validate_utf8), m_writer{writer}, m_buffer{resource} {}
+
+        output_sink_tcp(tcp_writer& writer, std::pmr::memory_resource* resource): output_sink_tcp(writer, false, resource) {}
+
+        explicit output_sink_tcp(std::pmr::memory_resource* resource): output_sink_tcp(tcp_writer::agent(), false, resource) {}
+
+        void done() {
+            m_writer.append(m_buffer);
+            m_buffer.clear();
+        }
+
+    private:
+        tcp_writer& m_writer;
+        std::pmr::string m_buffer;
+    };
+}
+
+#endif //BASE_CW_EMF_POSIX_H
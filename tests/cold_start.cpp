@@ -0,0 +1,31 @@
+//
+// A Lambda style handler that logs a single EMF message, used to compare
+// process start up and binary size with and without the AWS SDK.
+//
+
+#include <cw_emf.h>
+
+#if CW_EMF_AWS_SDK
+using test_unit = Aws::CloudWatch::Model::StandardUnit;
+#else
+using test_unit = cw_emf::unit;
+#endif
+
+int main() {
+    cw_emf::logger<"cold_start",
+            cw_emf::metrics<
+                    cw_emf::metric<"invocations", test_unit::Count>,
+                    cw_emf::metric<"duration", test_unit::Milliseconds>>,
+            cw_emf::dimensions<
+                    cw_emf::dimension_fixed<"version", "$LATEST">>> logger;
+
+    logger.put_metrics_value<"invocations">(1);
+    logger.put_metrics_value<"duration">(0.42);
+
+#if CW_EMF_AWS_SDK
+    // Forces the SDK monitoring library to be loaded, as unit names used to come from it
+    return Aws::CloudWatch::Model::StandardUnitMapper::GetNameForStandardUnit(test_unit::Count).empty();
+#else
+    return 0;
+#endif
+}
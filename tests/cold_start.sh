@@ -0,0 +1,25 @@
+#!/bin/sh
+#
+# Usage: cold_start.sh <runs> <binary>...
+#
+# Reports the size of each binary, the size of the shared libraries it loads
+# and the mean wall time of a process start, log and exit.
+#
+
+runs=$1
+shift
+
+for binary in "$@"; do
+    size=$(wc -c < "$binary")
+    libraries=$(ldd "$binary" | awk '/=> \// { print $3 }' | xargs -r cat | wc -c)
+
+    start=$(date +%s%N)
+    i=0
+    while [ "$i" -lt "$runs" ]; do
+        "$binary" > /dev/null
+        i=$((i + 1))
+    done
+    end=$(date +%s%N)
+
+    echo "$(basename "$binary"): binary ${size} bytes, shared libraries ${libraries} bytes, start up $(((end - start) / runs / 1000)) us"
+done
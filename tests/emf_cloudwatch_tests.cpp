@@ -0,0 +1,358 @@
+//
+// PutMetricData sink against a local stand-in for the CloudWatch endpoint
+//
+
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <map>
+#include <thread>
+#include <vector>
+
+#include "catch2.h"
+#include "json.h"
+
+#include <aws/core/Aws.h>
+#include <aws/core/auth/AWSCredentials.h>
+#include <aws/core/client/ClientConfiguration.h>
+
+#include <cw_emf_cloudwatch.h>
+
+
+/**
+ * Answers every HTTP request with an empty PutMetricData response and keeps the request bodies
+ */
+class http_listener {
+public:
+    http_listener() {
+        m_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+        ::sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (::bind(m_fd, reinterpret_cast<::sockaddr*>(&address), sizeof(address)) != 0 || ::listen(m_fd, 16) != 0)
+            throw std::runtime_error("listen failed");
+
+        m_thread = std::thread([this] {
+            std::vector<connection> connections;
+            while (!m_stop) {
+                std::vector<::pollfd> fds{{m_fd, POLLIN, 0}};
+                for (auto& connection: connections)
+                    fds.push_back({connection.fd, POLLIN, 0});
+                if (::poll(fds.data(), fds.size(), 10) <= 0)
+                    continue;
+
+                for (std::size_t i = 1; i < fds.size(); ++i) {
+                    if (!fds[i].revents)
+                        continue;
+                    auto& connection = connections[i - 1];
+                    char buffer[65536];
+                    ssize_t size = ::read(connection.fd, buffer, sizeof(buffer));
+                    if (size <= 0) {
+                        ::close(connection.fd);
+                        connection.fd = -1;
+                        continue;
+                    }
+                    connection.received.append(buffer, size);
+                    while (answer(connection)) {}
+                }
+                std::erase_if(connections, [](auto& connection) { return connection.fd < 0; });
+
+                if (fds[0].revents & POLLIN)
+                    connections.push_back({.fd = ::accept(m_fd, nullptr, nullptr), .received = {}});
+            }
+            for (auto& connection: connections)
+                ::close(connection.fd);
+        });
+    }
+
+    ~http_listener() {
+        m_stop = true;
+        m_thread.join();
+        ::close(m_fd);
+    }
+
+    Aws::String endpoint() const {
+        ::sockaddr_in address{};
+        ::socklen_t length = sizeof(address);
+        ::getsockname(m_fd, reinterpret_cast<::sockaddr*>(&address), &length);
+        return Aws::String("http://127.0.0.1:") + std::to_string(ntohs(address.sin_port)).c_str();
+    }
+
+    std::vector<std::string> bodies() {
+        std::lock_guard lock(m_mutex);
+        return m_bodies;
+    }
+
+private:
+    struct connection {
+        int fd;
+        std::string received;
+        bool continued{false};
+    };
+
+    int m_fd;
+    std::atomic<bool> m_stop{false};
+    std::mutex m_mutex;
+    std::vector<std::string> m_bodies;
+    std::thread m_thread;
+
+    static std::string lower(std::string text) {
+        std::transform(text.begin(), text.end(), text.begin(), [](unsigned char c) { return std::tolower(c); });
+        return text;
+    }
+
+    /**
+     * Answers the first request received on connection once it is complete and removes it, returns whether there
+     * was one
+     */
+    bool answer(connection& connection) {
+        auto& received = connection.received;
+        auto header_end = received.find("\r\n\r\n");
+        if (header_end == std::string::npos)
+            return false;
+
+        auto headers = lower(received.substr(0, header_end));
+        std::size_t content_length = 0;
+        if (auto position = headers.find("\r\ncontent-length:"); position != std::string::npos)
+            content_length = std::stoul(headers.substr(position + 17));
+        if (received.size() < header_end + 4 + content_length) {
+            if (!connection.continued && headers.find("\r\nexpect: 100-continue") != std::string::npos) {
+                std::string_view continue_response = "HTTP/1.1 100 Continue\r\n\r\n";
+                ::write(connection.fd, continue_response.data(), continue_response.size());
+                connection.continued = true;
+            }
+            return false;
+        }
+        connection.continued = false;
+
+        {
+            std::lock_guard lock(m_mutex);
+            m_bodies.push_back(received.substr(header_end + 4, content_length));
+        }
+        received.erase(0, header_end + 4 + content_length);
+
+        // The JSON protocol names the operation in a header, the query protocol in the body
+        std::string content_type = "text/xml";
+        std::string body = "<PutMetricDataResponse xmlns=\"http://monitoring.amazonaws.com/doc/2010-08-01/\">"
+                           "<ResponseMetadata><RequestId>test</RequestId></ResponseMetadata></PutMetricDataResponse>";
+        if (headers.find("\r\nx-amz-target:") != std::string::npos) {
+            content_type = "application/x-amz-json-1.0";
+            body = "{}";
+        }
+        std::string response = "HTTP/1.1 200 OK\r\nContent-Type: " + content_type + "\r\nx-amzn-RequestId: test\r\n"
+                               "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+        return ::write(connection.fd, response.data(), response.size()) == static_cast<ssize_t>(response.size());
+    }
+};
+
+/**
+ * The metric data of a request body, each as a flat map from the member name to its value
+ */
+std::vector<std::map<std::string, std::string>> metric_data(const std::string& body) {
+    std::vector<std::map<std::string, std::string>> data;
+
+    if (body.starts_with("{")) {
+        // Named like the query protocol: /Values/0 is Values.member.1
+        for (auto& datum: nlohmann::json::parse(body)["MetricData"]) {
+            auto& flat = data.emplace_back();
+            for (auto& [pointer, value]: datum.flatten().items()) {
+                std::string key;
+                for (std::size_t start = 1, end; start <= pointer.size(); start = end + 1) {
+                    end = std::min(pointer.find('/', start), pointer.size());
+                    auto part = pointer.substr(start, end - start);
+                    key += (key.empty() ? "" : ".")
+                           + (std::isdigit(part[0]) ? "member." + std::to_string(std::stoul(part) + 1) : part);
+                }
+                flat[key] = value.is_string() ? value.get<std::string>() : value.dump();
+            }
+        }
+        return data;
+    }
+
+    // Query protocol: MetricData.member.<n>.<member>=<value>&...
+    auto decode = [](std::string_view text) {
+        std::string decoded;
+        for (std::size_t i = 0; i < text.size(); ++i) {
+            if (text[i] == '%' && i + 2 < text.size()) {
+                decoded += static_cast<char>(std::stoi(std::string(text.substr(i + 1, 2)), nullptr, 16));
+                i += 2;
+            } else {
+                decoded += text[i] == '+' ? ' ' : text[i];
+            }
+        }
+        return decoded;
+    };
+
+    std::string_view parameters(body);
+    while (!parameters.empty()) {
+        auto end = std::min(parameters.find('&'), parameters.size());
+        auto parameter = parameters.substr(0, end);
+        parameters.remove_prefix(std::min(end + 1, parameters.size()));
+
+        auto key = decode(parameter.substr(0, parameter.find('=')));
+        auto value = decode(parameter.substr(std::min(parameter.find('='), parameter.size() - 1) + 1));
+        if (!key.starts_with("MetricData.member."))
+            continue;
+        key.erase(0, 18);
+        std::size_t index = std::stoul(key) - 1;
+        if (data.size() <= index)
+            data.resize(index + 1);
+        data[index][key.substr(key.find('.') + 1)] = value;
+    }
+    return data;
+}
+
+template<typename sink_t> using cloudwatch_test_logger = cw_emf::logger<"test_ns",
+        cw_emf::metrics<
+            cw_emf::metric<"latency", cw_emf::unit::Milliseconds>,
+            cw_emf::metric<"count", cw_emf::unit::Count, int>>,
+        cw_emf::dimensions<
+            cw_emf::dimension_fixed<"version", "$LATEST">,
+            cw_emf::dimension<"request_id">>,
+        cw_emf::log_messages<cw_emf::log_message<"tracing">>,
+        sink_t>;
+
+
+/**
+ * Initializes the SDK once for all sections, it is shut down at exit
+ */
+void initialize_sdk() {
+    static struct sdk {
+        Aws::SDKOptions options;
+        sdk() { Aws::InitAPI(options); }
+        ~sdk() { Aws::ShutdownAPI(options); }
+    } sdk;
+}
+
+
+TEST_CASE("PutMetricData Sink", "[main]") {
+    initialize_sdk();
+
+    {
+        http_listener cloudwatch;
+
+        Aws::Client::ClientConfiguration configuration;
+        configuration.region = "us-east-1";
+        configuration.scheme = Aws::Http::Scheme::HTTP;
+        configuration.endpointOverride = cloudwatch.endpoint();
+        auto client = std::make_shared<Aws::CloudWatch::CloudWatchClient>(Aws::Auth::AWSCredentials("test", "test"), configuration);
+
+        SECTION("Aggregates across flushes") {
+            cw_emf::put_metric_data_writer writer(client, std::chrono::hours(1));
+
+            for (int i=0; i < 3; ++i) {
+                cloudwatch_test_logger<cw_emf::output_sink_put_metric_data> logger(writer);
+                logger.put_metrics_value<0>(1.5);
+                logger.put_metrics_value<0>(i * 10.0);
+                logger.put_metrics_value<1>(1);
+                logger.dimension_value<1>("request");
+                logger.log_value<0>("not sent");
+            }
+            REQUIRE(cloudwatch.bodies().empty());
+
+            REQUIRE(writer.flush(std::chrono::seconds(10)));
+            REQUIRE(writer.requests() == 1);
+            REQUIRE(writer.failed_requests() == 0);
+            REQUIRE(writer.metric_data() == 2);
+
+            auto bodies = cloudwatch.bodies();
+            REQUIRE(bodies.size() == 1);
+            REQUIRE(bodies[0].find("test_ns") != std::string::npos);
+            REQUIRE(bodies[0].find("not sent") == std::string::npos);
+
+            auto data = metric_data(bodies[0]);
+            REQUIRE(data.size() == 2);
+            std::sort(data.begin(), data.end(), [](auto& a, auto& b) { return a["MetricName"] < b["MetricName"]; });
+
+            REQUIRE(data[0]["MetricName"] == "count");
+            REQUIRE(data[0]["Unit"] == "Count");
+            REQUIRE(std::stod(data[0]["Values.member.1"]) == 1);
+            REQUIRE(std::stod(data[0]["Counts.member.1"]) == 3);
+            REQUIRE(data[0].count("Values.member.2") == 0);
+
+            REQUIRE(data[1]["MetricName"] == "latency");
+            REQUIRE(data[1]["Unit"] == "Milliseconds");
+            REQUIRE(data[1]["Dimensions.member.1.Name"] == "version");
+            REQUIRE(data[1]["Dimensions.member.1.Value"] == "$LATEST");
+            REQUIRE(data[1]["Dimensions.member.2.Name"] == "request_id");
+            REQUIRE(data[1]["Dimensions.member.2.Value"] == "request");
+            // 0, 1.5 three times, 10, 20
+            REQUIRE(std::stod(data[1]["Values.member.2"]) == 1.5);
+            REQUIRE(std::stod(data[1]["Counts.member.2"]) == 3);
+            REQUIRE(data[1].count("Values.member.4") == 1);
+            REQUIRE(data[1].count("Values.member.5") == 0);
+        }
+
+        SECTION("Splits requests at the batch limits") {
+            cw_emf::put_metric_data_writer writer(client, std::chrono::hours(1));
+
+            for (int i=0; i < 1250; ++i) {
+                cloudwatch_test_logger<cw_emf::output_sink_put_metric_data> logger(writer);
+                logger.put_metrics_value<0>(i);
+                logger.put_metrics_value<1>(i);
+                logger.dimension_value<1>("request_" + std::to_string(i));
+            }
+
+            REQUIRE(writer.flush(std::chrono::seconds(30)));
+            REQUIRE(writer.requests() == 3);
+            REQUIRE(writer.metric_data() == 2500);
+
+            std::vector<std::size_t> sizes;
+            for (auto& body: cloudwatch.bodies())
+                sizes.push_back(metric_data(body).size());
+            std::sort(sizes.begin(), sizes.end());
+            REQUIRE(sizes == std::vector<std::size_t>{500, 1000, 1000});
+
+            REQUIRE_THROWS_AS(cw_emf::put_metric_data_writer(client, std::chrono::hours(1), 1001), std::out_of_range);
+        }
+
+        SECTION("Statistic values when the values do not fit") {
+            cw_emf::put_metric_data_writer writer(client, std::chrono::hours(1));
+
+            for (int i=0; i < 4; ++i) {
+                cloudwatch_test_logger<cw_emf::output_sink_put_metric_data> logger(writer);
+                for (int value=0; value < 50; ++value)
+                    logger.put_metrics_value<0>(i * 50 + value);
+                logger.dimension_value<1>("request");
+            }
+
+            REQUIRE(writer.flush(std::chrono::seconds(10)));
+            auto bodies = cloudwatch.bodies();
+            REQUIRE(bodies.size() == 1);
+
+            auto data = metric_data(bodies[0]);
+            REQUIRE(data.size() == 1);
+            REQUIRE(data[0]["MetricName"] == "latency");
+            REQUIRE(data[0].count("Values.member.1") == 0);
+            REQUIRE(std::stod(data[0]["StatisticValues.SampleCount"]) == 200);
+            REQUIRE(std::stod(data[0]["StatisticValues.Sum"]) == 199 * 200 / 2);
+            REQUIRE(std::stod(data[0]["StatisticValues.Minimum"]) == 0);
+            REQUIRE(std::stod(data[0]["StatisticValues.Maximum"]) == 199);
+        }
+
+        SECTION("Interval and missing dimension values") {
+            cw_emf::put_metric_data_writer writer(client, std::chrono::milliseconds(50));
+
+            // request_id is declared but never set
+            {
+                cloudwatch_test_logger<cw_emf::output_sink_put_metric_data> logger(writer);
+                logger.put_metrics_value<0>(1.5);
+            }
+            REQUIRE(writer.errors() == 1);
+
+            {
+                cloudwatch_test_logger<cw_emf::output_sink_put_metric_data> logger(writer);
+                logger.put_metrics_value<1>(7);
+                logger.dimension_value<1>("request");
+            }
+            for (int i=0; i < 500 && writer.requests() == 0; ++i)
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            REQUIRE(writer.requests() == 1);
+            REQUIRE(writer.metric_data() == 1);
+        }
+    }
+}
@@ -0,0 +1,208 @@
+//
+// Metric data for PutMetricData, aggregated and split without the AWS SDK
+//
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "catch2.h"
+
+#include <cw_emf_metric_data.h>
+
+
+/**
+ * Stands in for put_metric_data_writer: merges every flush and splits on request
+ */
+struct metric_data_target {
+    cw_emf::metric_data_aggregate data;
+    std::size_t errors{0};
+
+    void add(cw_emf::metric_data_aggregate& flushed, std::size_t flushed_errors) {
+        errors += flushed_errors;
+        data.merge(flushed);
+    }
+
+    std::vector<std::vector<cw_emf::metric_datum>> requests(std::size_t metric_data_per_request = cw_emf::metric_data_aggregate::max_metric_data) const {
+        std::vector<std::vector<cw_emf::metric_datum>> requests;
+        data.split(metric_data_per_request, [&](const std::vector<const cw_emf::metric_datum*>& request) {
+            auto& copy = requests.emplace_back();
+            for (auto* datum: request)
+                copy.push_back(*datum);
+        });
+        return requests;
+    }
+};
+
+template<typename sink_t, cw_emf::internal::named ns = "test_ns"> using metric_data_test_logger = cw_emf::logger<ns,
+        cw_emf::metrics<
+            cw_emf::metric<"latency", cw_emf::unit::Milliseconds>,
+            cw_emf::metric<"count", cw_emf::unit::Count, int>>,
+        cw_emf::dimensions<
+            cw_emf::dimension_fixed<"version", "$LATEST">,
+            cw_emf::dimension<"request_id">>,
+        cw_emf::log_messages<cw_emf::log_message<"tracing">>,
+        sink_t>;
+
+using metric_data_sink = cw_emf::basic_output_sink_metric_data<metric_data_target>;
+
+
+TEST_CASE("Metric Data Sink", "[main]") {
+    metric_data_target target;
+
+    SECTION("Aggregates across flushes") {
+        for (int i=0; i < 3; ++i) {
+            metric_data_test_logger<metric_data_sink> logger(target);
+            logger.put_metrics_value<0>(1.5);
+            logger.put_metrics_value<0>(i * 10.0);
+            logger.put_metrics_value<1>(1);
+            logger.dimension_value<1>("request");
+            logger.log_value<0>("not sent");
+        }
+        REQUIRE(target.errors == 0);
+        REQUIRE(target.data.size() == 2);
+
+        auto requests = target.requests();
+        REQUIRE(requests.size() == 1);
+        auto& data = requests[0];
+        std::sort(data.begin(), data.end(), [](auto& a, auto& b) { return a.name < b.name; });
+
+        REQUIRE(data[0].emf_namespace == "test_ns");
+        REQUIRE(data[0].name == "count");
+        REQUIRE(data[0].unit == "Count");
+        REQUIRE(data[0].counts == std::map<double, double>{{1, 3}});
+
+        REQUIRE(data[1].name == "latency");
+        REQUIRE(data[1].unit == "Milliseconds");
+        REQUIRE(data[1].dimensions == std::vector<std::pair<std::string, std::string>>{{"version", "$LATEST"}, {"request_id", "request"}});
+        // 0, 1.5 three times, 10, 20
+        REQUIRE(data[1].counts == std::map<double, double>{{0, 1}, {1.5, 3}, {10, 1}, {20, 1}});
+        REQUIRE(data[1].sample_count == 6);
+        REQUIRE(data[1].sum == 34.5);
+        REQUIRE(!data[1].statistics_only);
+    }
+
+    SECTION("Distinct dimension values are distinct data") {
+        for (int i=0; i < 4; ++i) {
+            metric_data_test_logger<metric_data_sink> logger(target);
+            logger.put_metrics_value<1>(i);
+            logger.dimension_value<1>(i % 2 ? "odd" : "even");
+        }
+        REQUIRE(target.data.size() == 2);
+
+        auto requests = target.requests();
+        REQUIRE(requests.size() == 1);
+        for (auto& datum: requests[0])
+            REQUIRE(datum.sample_count == 2);
+    }
+
+    SECTION("Missing dimension values are errors") {
+        // request_id is declared but never set
+        {
+            metric_data_test_logger<metric_data_sink> logger(target);
+            logger.put_metrics_value<0>(1.5);
+        }
+        {
+            metric_data_test_logger<metric_data_sink> logger(target);
+            logger.put_metrics_value<0>(1.5);
+            logger.dimension_value<1>("");
+        }
+        REQUIRE(target.errors == 2);
+        REQUIRE(target.data.empty());
+
+        {
+            metric_data_test_logger<metric_data_sink> logger(target);
+            logger.put_metrics_value<1>(7);
+            logger.dimension_value<1>("request");
+        }
+        REQUIRE(target.errors == 2);
+        REQUIRE(target.data.size() == 1);
+    }
+
+    SECTION("Statistic values when the values do not fit") {
+        for (int i=0; i < 4; ++i) {
+            metric_data_test_logger<metric_data_sink> logger(target);
+            for (int value=0; value < 50; ++value)
+                logger.put_metrics_value<0>(i * 50 + value);
+            logger.dimension_value<1>("request");
+        }
+
+        auto requests = target.requests();
+        REQUIRE(requests.size() == 1);
+        REQUIRE(requests[0].size() == 1);
+
+        auto& datum = requests[0][0];
+        REQUIRE(datum.name == "latency");
+        REQUIRE(datum.statistics_only);
+        REQUIRE(datum.counts.empty());
+        REQUIRE(datum.sample_count == 200);
+        REQUIRE(datum.sum == 199 * 200 / 2);
+        REQUIRE(datum.minimum == 0);
+        REQUIRE(datum.maximum == 199);
+    }
+
+    SECTION("Splits requests at the batch limits") {
+        for (int i=0; i < 1250; ++i) {
+            metric_data_test_logger<metric_data_sink> logger(target);
+            logger.put_metrics_value<0>(i);
+            logger.put_metrics_value<1>(i);
+            logger.dimension_value<1>("request_" + std::to_string(i));
+        }
+        REQUIRE(target.data.size() == 2500);
+
+        std::vector<std::size_t> sizes;
+        for (auto& request: target.requests())
+            sizes.push_back(request.size());
+        std::sort(sizes.begin(), sizes.end());
+        REQUIRE(sizes == std::vector<std::size_t>{500, 1000, 1000});
+
+        sizes.clear();
+        for (auto& request: target.requests(600))
+            sizes.push_back(request.size());
+        REQUIRE(sizes == std::vector<std::size_t>{600, 600, 600, 600, 100});
+    }
+
+    SECTION("Splits requests by namespace") {
+        {
+            metric_data_test_logger<metric_data_sink, "first_ns"> logger(target);
+            logger.put_metrics_value<0>(1);
+            logger.dimension_value<1>("request");
+        }
+        {
+            metric_data_test_logger<metric_data_sink, "second_ns"> logger(target);
+            logger.put_metrics_value<0>(1);
+            logger.dimension_value<1>("request");
+        }
+
+        auto requests = target.requests();
+        REQUIRE(requests.size() == 2);
+        REQUIRE(requests[0].size() == 1);
+        REQUIRE(requests[0][0].emf_namespace == "first_ns");
+        REQUIRE(requests[1].size() == 1);
+        REQUIRE(requests[1][0].emf_namespace == "second_ns");
+    }
+
+    SECTION("Splits requests by size") {
+        // 150 distinct values each, about 19 KB per datum
+        for (int i=0; i < 120; ++i) {
+            metric_data_test_logger<metric_data_sink> logger(target);
+            for (int value=0; value < 150; ++value)
+                logger.put_metrics_value<0>(value);
+            logger.dimension_value<1>("request_" + std::to_string(i));
+        }
+
+        auto requests = target.requests();
+        REQUIRE(requests.size() > 1);
+
+        std::size_t data = 0;
+        for (auto& request: requests) {
+            std::size_t size = 0;
+            for (auto& datum: request)
+                size += datum.encoded_size();
+            REQUIRE(size <= cw_emf::metric_data_aggregate::max_request_size);
+            data += request.size();
+        }
+        REQUIRE(data == 120);
+    }
+}
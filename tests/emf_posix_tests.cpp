@@ -0,0 +1,1027 @@
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <csignal>
+#include <fstream>
+#include <optional>
+#include <regex>
+#include <thread>
+#include <vector>
+
+#include "catch2.h"
+#include "json.h"
+
+#include <cw_emf_posix.h>
+
+
+std::vector<nlohmann::json> split_string_by_newline(const std::string& str);
+
+/**
+ * A temporary file to write to and read back
+ */
+class temporary_file {
+public:
+    temporary_file(): m_file{std::tmpfile()} {}
+
+    ~temporary_file() {
+        std::fclose(m_file);
+    }
+
+    int fd() const {
+        return fileno(m_file);
+    }
+
+    std::string content() const {
+        std::string result;
+        char buffer[4096];
+        for (ssize_t size; (size = ::pread(fd(), buffer, sizeof(buffer), result.size())) > 0;)
+            result.append(buffer, size);
+        return result;
+    }
+
+private:
+    std::FILE* m_file;
+};
+
+/**
+ * A pipe whose read end is drained into a string by a thread of its own
+ */
+class draining_pipe {
+public:
+    draining_pipe() {
+        if (::pipe(m_fds) != 0)
+            throw std::runtime_error("pipe failed");
+        m_thread = std::thread([this] {
+            char buffer[65536];
+            for (ssize_t size; (size = ::read(m_fds[0], buffer, sizeof(buffer))) > 0;)
+                if (m_keep)
+                    m_content.append(buffer, size);
+        });
+    }
+
+    explicit draining_pipe(bool keep): draining_pipe() {
+        m_keep = keep;
+    }
+
+    ~draining_pipe() {
+        close();
+    }
+
+    int fd() const {
+        return m_fds[1];
+    }
+
+    /**
+     * Closes the write end and returns everything read
+     */
+    std::string close() {
+        if (m_fds[1] >= 0) {
+            ::close(m_fds[1]);
+            m_fds[1] = -1;
+            m_thread.join();
+            ::close(m_fds[0]);
+        }
+        return m_content;
+    }
+
+private:
+    int m_fds[2];
+    bool m_keep{true};
+    std::string m_content;
+    std::thread m_thread;
+};
+
+/**
+ * Points stdout at fd until destroyed
+ */
+class redirected_stdout {
+public:
+    explicit redirected_stdout(int fd) {
+        std::fflush(stdout);
+        m_saved = ::dup(STDOUT_FILENO);
+        ::dup2(fd, STDOUT_FILENO);
+    }
+
+    ~redirected_stdout() {
+        std::fflush(stdout);
+        ::dup2(m_saved, STDOUT_FILENO);
+        ::close(m_saved);
+    }
+
+private:
+    int m_saved;
+};
+
+/**
+ * Number of write system calls of the process so far, from /proc/self/io
+ */
+std::size_t write_system_calls() {
+    std::ifstream io("/proc/self/io");
+    std::string key;
+    std::size_t value = 0;
+    while (io >> key >> value)
+        if (key == "syscw:")
+            return value;
+    return 0;
+}
+
+/**
+ * Stand-in for the CloudWatch agent, a datagram socket bound to a local address which a thread of its own reads
+ */
+class datagram_listener {
+public:
+    explicit datagram_listener(const ::sockaddr* address, ::socklen_t length) {
+        m_fd = ::socket(address->sa_family, SOCK_DGRAM, 0);
+        if (m_fd < 0 || ::bind(m_fd, address, length) != 0)
+            throw std::runtime_error("bind failed");
+        ::timeval timeout{0, 10000};
+        ::setsockopt(m_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        int size = 1 << 22;
+        ::setsockopt(m_fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+        m_thread = std::thread([this] {
+            std::string buffer(1 << 17, ' ');
+            while (!m_stop) {
+                ssize_t size = ::recv(m_fd, buffer.data(), buffer.size(), 0);
+                if (size >= 0) {
+                    std::lock_guard lock(m_mutex);
+                    m_datagrams.push_back(buffer.substr(0, size));
+                }
+            }
+        });
+    }
+
+    ~datagram_listener() {
+        m_stop = true;
+        m_thread.join();
+        ::close(m_fd);
+    }
+
+    std::uint16_t port() const {
+        ::sockaddr_in address{};
+        ::socklen_t length = sizeof(address);
+        ::getsockname(m_fd, reinterpret_cast<::sockaddr*>(&address), &length);
+        return ntohs(address.sin_port);
+    }
+
+    /**
+     * Waits up to a second for count datagrams and takes the ones received
+     */
+    std::vector<std::string> receive(std::size_t count) {
+        for (int i=0; i < 100; ++i) {
+            {
+                std::lock_guard lock(m_mutex);
+                if (m_datagrams.size() >= count)
+                    break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        std::lock_guard lock(m_mutex);
+        return std::exchange(m_datagrams, {});
+    }
+
+private:
+    int m_fd;
+    std::atomic<bool> m_stop{false};
+    std::mutex m_mutex;
+    std::vector<std::string> m_datagrams;
+    std::thread m_thread;
+};
+
+/**
+ * Stand-in for the TCP endpoint of the CloudWatch agent on 127.0.0.1, accepting one connection after the other
+ * and collecting what they send
+ */
+class tcp_listener {
+public:
+    explicit tcp_listener(std::uint16_t port = 0) {
+        m_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+        int reuse = 1;
+        ::setsockopt(m_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        ::sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = htons(port);
+        if (::bind(m_fd, reinterpret_cast<::sockaddr*>(&address), sizeof(address)) != 0 || ::listen(m_fd, 4) != 0)
+            throw std::runtime_error("listen failed");
+
+        m_thread = std::thread([this] {
+            char buffer[65536];
+            int connection = -1;
+            while (!m_stop) {
+                ::pollfd fds[2] = {{m_fd, POLLIN, 0}, {connection, POLLIN, 0}};
+                if (::poll(fds, connection < 0 ? 1 : 2, 10) <= 0) {
+                    if (m_drop && connection >= 0) {
+                        ::close(connection);
+                        connection = -1;
+                    }
+                    m_drop = false;
+                    continue;
+                }
+                if (fds[0].revents & POLLIN) {
+                    if (connection >= 0)
+                        ::close(connection);
+                    connection = ::accept(m_fd, nullptr, nullptr);
+                    ++m_connections;
+                }
+                if (connection >= 0 && fds[1].revents) {
+                    ssize_t size = ::read(connection, buffer, sizeof(buffer));
+                    if (size <= 0) {
+                        ::close(connection);
+                        connection = -1;
+                    } else {
+                        std::lock_guard lock(m_mutex);
+                        m_content.append(buffer, size);
+                    }
+                }
+            }
+            if (connection >= 0)
+                ::close(connection);
+        });
+    }
+
+    ~tcp_listener() {
+        m_stop = true;
+        m_thread.join();
+        ::close(m_fd);
+    }
+
+    std::uint16_t port() const {
+        ::sockaddr_in address{};
+        ::socklen_t length = sizeof(address);
+        ::getsockname(m_fd, reinterpret_cast<::sockaddr*>(&address), &length);
+        return ntohs(address.sin_port);
+    }
+
+    /**
+     * Closes the current connection the next time the listener is idle
+     */
+    void drop_connection() {
+        m_drop = true;
+    }
+
+    std::size_t connections() const {
+        return m_connections;
+    }
+
+    /**
+     * Waits up to 5 seconds until size bytes arrived and returns them
+     */
+    std::string content(std::size_t size) {
+        for (int i=0; i < 500; ++i) {
+            {
+                std::lock_guard lock(m_mutex);
+                if (m_content.size() >= size)
+                    break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        std::lock_guard lock(m_mutex);
+        return m_content;
+    }
+
+private:
+    int m_fd;
+    std::atomic<bool> m_stop{false};
+    std::atomic<bool> m_drop{false};
+    std::atomic<std::size_t> m_connections{0};
+    std::mutex m_mutex;
+    std::string m_content;
+    std::thread m_thread;
+};
+
+template<typename sink_t> using fd_test_logger = cw_emf::logger<"test_ns",
+        cw_emf::metrics<
+            cw_emf::metric<"latency_with_a_long_name", cw_emf::unit::Milliseconds>,
+            cw_emf::metric<"count", cw_emf::unit::Count, int>>,
+        cw_emf::dimensions<
+            cw_emf::dimension_fixed<"version", "$LATEST">,
+            cw_emf::dimension<"request_id">>,
+        cw_emf::log_messages<cw_emf::log_message<"tracing">>,
+        sink_t>;
+
+using posix_logger = cw_emf::logger<"test_ns",
+        cw_emf::metrics<cw_emf::metric<"latency", cw_emf::unit::Milliseconds>>,
+        cw_emf::dimensions<cw_emf::dimension<"request_id">>,
+        cw_emf::log_messages<>,
+        cw_emf::output_sink_batch>;
+
+
+TEST_CASE("POSIX Sinks", "[main]") {
+
+    SECTION("File descriptor sink") {
+        std::string elements;
+        temporary_file file;
+        {
+            fd_test_logger<cw_emf::output_sink_string> string_logger(elements);
+            fd_test_logger<cw_emf::output_sink_fd> fd_logger(file.fd());
+            auto log = [](auto& logger) {
+                for (int i=0; i < 20; ++i)
+                    logger.template put_metrics_value<0>(i * 1.5);
+                logger.template put_metrics_value<1>(3);
+                logger.template dimension_value<1>("7c1c8a5e-4d1a-4a6f-9b0e-3f7c8d2e1a90");
+                logger.template log_value<0>("a \"quoted\" trace");
+                logger.flush();
+            };
+            log(string_logger);
+            log(fd_logger);
+            fd_logger.flush();
+        }
+
+        std::regex timestamp("\"Timestamp\":[0-9]+");
+        // Flushing does not clear the logger, each flush and the destructor write the same message
+        std::string elements_written = std::regex_replace(elements, timestamp, "");
+        std::string message = elements_written.substr(0, elements_written.size() / 2);
+        REQUIRE(elements_written == message + message);
+        REQUIRE(std::regex_replace(file.content(), timestamp, "") == message + message + message);
+
+        // A pipe nobody reads any more fails with EPIPE, which is counted
+        int fds[2];
+        REQUIRE(::pipe(fds) == 0);
+        ::close(fds[0]);
+        auto previous = std::signal(SIGPIPE, SIG_IGN);
+        std::size_t errors = cw_emf::output_sink_fd::errors();
+        {
+            fd_test_logger<cw_emf::output_sink_fd> logger(fds[1]);
+            logger.put_metrics_value<1>(1);
+            logger.flush();
+        }
+        std::signal(SIGPIPE, previous);
+        ::close(fds[1]);
+        REQUIRE(cw_emf::output_sink_fd::errors() == errors + 2);
+    }
+
+    SECTION("Scatter gather writes") {
+        // More buffers than IOV_MAX and more bytes than the pipe holds, writev returns after partial writes
+        std::string expected;
+        std::vector<std::string> parts;
+        for (int i=0; i < 5000; ++i)
+            parts.push_back(std::to_string(i) + std::string(i % 97, 'x') + "\n");
+
+        std::vector<::iovec> iov;
+        for (auto& part: parts) {
+            iov.push_back({part.data(), part.size()});
+            expected += part;
+        }
+
+        draining_pipe pipe;
+        REQUIRE(cw_emf::internal::writev_all(pipe.fd(), iov.data(), iov.size()));
+        REQUIRE(pipe.close() == expected);
+    }
+
+    SECTION("io_uring writes") {
+        temporary_file file;
+        std::string expected;
+        {
+            // Small buffers, so that messages span buffers and appends wait for free ones
+            cw_emf::uring_writer writer(file.fd(), 256, 3);
+            for (int i=0; i < 1000; ++i) {
+                std::string buffer;
+                {
+                    fd_test_logger<cw_emf::output_sink_string> string_logger(buffer);
+                    string_logger.put_metrics_value<1>(i);
+                }
+                expected += buffer;
+                writer.append(buffer);
+            }
+            writer.flush();
+            REQUIRE(file.content() == expected);
+            REQUIRE(writer.errors() == 0);
+            INFO("io_uring: " << writer.uses_uring() << ", registered buffers: " << writer.registered());
+
+            writer.append("{\"last\":1}\n");
+        }
+        REQUIRE(file.content() == expected + "{\"last\":1}\n");
+
+        {
+            // A pipe of one page, writes wait for the reader while the buffers fill and go out as chains
+            draining_pipe pipe;
+#if defined(F_SETPIPE_SZ)
+            ::fcntl(pipe.fd(), F_SETPIPE_SZ, 4096);
+#endif
+            cw_emf::uring_writer writer(pipe.fd(), 256, 8);
+            expected.clear();
+            for (int i=0; i < 5000; ++i) {
+                std::string message = "{\"message\":" + std::to_string(i) + "}\n";
+                expected += message;
+                writer.append(message);
+            }
+            writer.flush();
+            REQUIRE(writer.errors() == 0);
+            REQUIRE(pipe.close() == expected);
+        }
+
+#if CW_EMF_URING
+        // Kernels that take -1 as the current position, 5.6 on, can also be probed for IORING_OP_WRITE
+        cw_emf::internal::uring ring(2);
+        if (ring.valid() && (ring.features() & IORING_FEAT_RW_CUR_POS)) {
+            REQUIRE(ring.supports(IORING_OP_NOP));
+            REQUIRE(ring.supports(IORING_OP_WRITE));
+            REQUIRE_FALSE(ring.supports(255));
+
+            cw_emf::uring_writer writer(file.fd(), 256, 3);
+            REQUIRE(writer.opcode() == (writer.registered() ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE));
+        }
+#endif
+
+        temporary_file logged;
+        {
+            cw_emf::uring_writer writer(logged.fd());
+            fd_test_logger<cw_emf::output_sink_uring> logger(writer);
+            logger.put_metrics_value<1>(42);
+        }
+        REQUIRE(split_string_by_newline(logged.content())[0]["count"] == 42);
+
+        cw_emf::uring_writer closed(-1);
+        closed.append("{}\n");
+        closed.flush();
+        REQUIRE(closed.errors() == 1);
+    }
+
+    SECTION("vmsplice writes") {
+        auto log = [](auto& logger, int i, std::size_t trace_size) {
+            logger.template put_metrics_value<1>(i);
+            logger.template log_value<0>(std::string(trace_size, 'a' + i % 26));
+        };
+        std::regex timestamp("\"Timestamp\":[0-9]+");
+
+        std::string expected;
+        draining_pipe pipe;
+        {
+            cw_emf::vmsplice_writer writer(pipe.fd(), 4096);
+            REQUIRE(writer.uses_vmsplice());
+            for (int i=0; i < 200; ++i) {
+                // Every 50th message does not fit into a buffer
+                std::size_t trace_size = i % 50 == 49 ? 10000 : 1000;
+                {
+                    fd_test_logger<cw_emf::output_sink_string> logger(expected);
+                    log(logger, i, trace_size);
+                }
+                fd_test_logger<cw_emf::output_sink_vmsplice> logger(writer);
+                log(logger, i, trace_size);
+            }
+            INFO("spliced " << writer.bytes_spliced() << ", written " << writer.bytes_written());
+            REQUIRE(writer.bytes_spliced() > 0);
+            REQUIRE(writer.bytes_written() >= 4 * 10000);
+            REQUIRE(writer.errors() == 0);
+        }
+        REQUIRE(std::regex_replace(pipe.close(), timestamp, "") == std::regex_replace(expected, timestamp, ""));
+    }
+
+    SECTION("vmsplice buffers are only reused once read") {
+        int fds[2];
+        REQUIRE(::pipe(fds) == 0);
+        std::string expected;
+        {
+            cw_emf::vmsplice_writer writer(fds[1], 4096, 2);
+            auto write = [&writer, &expected](int i) {
+                std::string buffer;
+                {
+                    fd_test_logger<cw_emf::output_sink_string> logger(buffer);
+                    logger.put_metrics_value<1>(i);
+                }
+                expected += buffer;
+                fd_test_logger<cw_emf::output_sink_vmsplice> logger(writer);
+                logger.put_metrics_value<1>(i);
+                return buffer.size();
+            };
+
+            // Nobody reads, the first two messages take the two buffers and the next ones are written
+            std::size_t size = write(0);
+            write(1);
+            REQUIRE(writer.bytes_spliced() == 2 * size);
+            write(2);
+            write(3);
+            REQUIRE(writer.bytes_spliced() == 2 * size);
+            REQUIRE(writer.bytes_written() == 2 * size);
+
+            // Once the first message is read, its buffer is used again
+            std::string first(size, ' ');
+            REQUIRE(::read(fds[0], first.data(), size) == static_cast<ssize_t>(size));
+            write(4);
+            REQUIRE(writer.bytes_spliced() == 3 * size);
+            expected = expected.substr(size);
+        }
+        ::close(fds[1]);
+
+        std::string content;
+        char buffer[4096];
+        for (ssize_t size; (size = ::read(fds[0], buffer, sizeof(buffer))) > 0;)
+            content.append(buffer, size);
+        ::close(fds[0]);
+
+        std::regex timestamp("\"Timestamp\":[0-9]+");
+        REQUIRE(std::regex_replace(content, timestamp, "") == std::regex_replace(expected, timestamp, ""));
+    }
+
+    SECTION("vmsplice buffers stay taken after a failed write") {
+        int fds[2];
+        REQUIRE(::pipe2(fds, O_NONBLOCK) == 0);
+        {
+            cw_emf::vmsplice_writer writer(fds[1], 4096, 1);
+            {
+                fd_test_logger<cw_emf::output_sink_vmsplice> logger(writer);
+                logger.put_metrics_value<1>(1);
+            }
+            REQUIRE(writer.bytes_spliced() > 0);
+
+            // Fills the pipe, only part of the message gets in before EAGAIN
+            writer.write(std::string(1 << 20, 'x'));
+            REQUIRE(writer.errors() == 1);
+            int unread = 0;
+            REQUIRE(::ioctl(fds[0], FIONREAD, &unread) == 0);
+            REQUIRE(writer.bytes_spliced() + writer.bytes_written() == static_cast<std::size_t>(unread));
+
+            // Nothing was read, the pipe still refers to the spliced buffer
+            REQUIRE(writer.available() == 0);
+        }
+        ::close(fds[0]);
+        ::close(fds[1]);
+    }
+
+    SECTION("vmsplice writer on a file") {
+        temporary_file file;
+        std::string expected;
+        {
+            cw_emf::vmsplice_writer writer(file.fd());
+            REQUIRE_FALSE(writer.uses_vmsplice());
+            {
+                fd_test_logger<cw_emf::output_sink_string> logger(expected);
+                logger.put_metrics_value<1>(7);
+            }
+            fd_test_logger<cw_emf::output_sink_vmsplice> logger(writer);
+            logger.put_metrics_value<1>(7);
+        }
+        std::regex timestamp("\"Timestamp\":[0-9]+");
+        REQUIRE(std::regex_replace(file.content(), timestamp, "") == std::regex_replace(expected, timestamp, ""));
+    }
+
+    SECTION("Messages within PIPE_BUF") {
+        temporary_file file;
+        std::size_t oversized = cw_emf::output_sink_atomic::oversized();
+        {
+            fd_test_logger<cw_emf::output_sink_atomic> logger(file.fd());
+            for (int i=0; i < 1000; ++i)
+                logger.put_metrics_value<0>(i + 0.123456789);
+            logger.log_value<0>(std::string(2500, 't'));
+        }
+        REQUIRE(cw_emf::output_sink_atomic::oversized() == oversized);
+
+        std::string content = file.content();
+        std::vector<double> values;
+        for (auto& message: split_string_by_newline(content)) {
+            REQUIRE(message["tracing"] == std::string(2500, 't'));
+            for (double value: message["latency_with_a_long_name"])
+                values.push_back(value);
+        }
+        REQUIRE(values.size() == 1000);
+        for (int i=0; i < 1000; ++i)
+            REQUIRE(values[i] == i + 0.123456789);
+
+        // 100 values per message would not fit
+        std::size_t start = 0;
+        for (std::size_t end; (end = content.find('\n', start)) != std::string::npos; start = end + 1) {
+            REQUIRE(end + 1 - start <= PIPE_BUF);
+            REQUIRE(end + 1 - start > PIPE_BUF / 2);
+        }
+
+        temporary_file large;
+        {
+            fd_test_logger<cw_emf::output_sink_atomic> logger(large.fd());
+            logger.put_metrics_value<0>(1.0);
+            logger.put_metrics_value<0>(2.0);
+            logger.log_value<0>(std::string(PIPE_BUF, 't'));
+        }
+        REQUIRE(cw_emf::output_sink_atomic::oversized() == oversized + 2);
+        auto large_messages = split_string_by_newline(large.content());
+        REQUIRE(large_messages.size() == 2);
+        REQUIRE(large_messages[1]["latency_with_a_long_name"] == nlohmann::json::array({2.0}));
+    }
+
+    SECTION("Atomic writes from many threads") {
+        constexpr int threads = 8;
+        constexpr int loggers = 200;
+        std::size_t errors = cw_emf::output_sink_atomic::errors();
+
+        draining_pipe pipe;
+        std::vector<std::thread> workers;
+        for (int t=0; t < threads; ++t) {
+            workers.emplace_back([&pipe, t] {
+                for (int i=0; i < loggers; ++i) {
+                    fd_test_logger<cw_emf::output_sink_atomic> logger(pipe.fd());
+                    for (int value=0; value < (i * 37) % 300 + 1; ++value)
+                        logger.put_metrics_value<0>(t * 1000 + value / 1000.0);
+                    logger.put_metrics_value<1>(i);
+                    logger.dimension_value<1>(std::to_string(t) + "_" + std::to_string(i));
+                    logger.log_value<0>(std::string((i * 101) % 3000, 'a' + t));
+                }
+            });
+        }
+        for (auto& worker: workers)
+            worker.join();
+        std::string content = pipe.close();
+        REQUIRE(cw_emf::output_sink_atomic::errors() == errors);
+
+        // Every line is a whole message of one logger
+        std::vector<std::vector<std::size_t>> values(threads, std::vector<std::size_t>(loggers));
+        std::size_t start = 0;
+        for (std::size_t end; (end = content.find('\n', start)) != std::string::npos; start = end + 1) {
+            REQUIRE(end + 1 - start <= PIPE_BUF);
+            auto message = nlohmann::json::parse(content.substr(start, end - start));
+            std::string request_id = message["request_id"];
+            int t = std::stoi(request_id);
+            int i = std::stoi(request_id.substr(request_id.find('_') + 1));
+            REQUIRE(message["tracing"] == std::string((i * 101) % 3000, 'a' + t));
+            auto latency = message["latency_with_a_long_name"];
+            values[t][i] += latency.is_array() ? latency.size() : 1;
+        }
+        REQUIRE(start == content.size());
+        for (int t=0; t < threads; ++t)
+            for (int i=0; i < loggers; ++i)
+                REQUIRE(values[t][i] == static_cast<std::size_t>((i * 37) % 300 + 1));
+    }
+
+    SECTION("UDP datagrams") {
+        ::sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        datagram_listener agent(reinterpret_cast<::sockaddr*>(&address), sizeof(address));
+        auto socket = cw_emf::datagram_socket::udp("127.0.0.1", agent.port());
+
+        {
+            // 350 values are four messages, sent with one system call
+            fd_test_logger<cw_emf::output_sink_udp> logger(socket);
+            for (int i=0; i < 350; ++i)
+                logger.put_metrics_value<0>(i);
+        }
+        REQUIRE(socket.system_calls() == 1);
+        REQUIRE(socket.datagrams() == 4);
+
+        auto datagrams = agent.receive(4);
+        REQUIRE(datagrams.size() == 4);
+        std::size_t values = 0;
+        for (auto& datagram: datagrams) {
+            REQUIRE(datagram.back() == '\n');
+            values += nlohmann::json::parse(datagram)["latency_with_a_long_name"].size();
+        }
+        REQUIRE(values == 350);
+
+        {
+            // Too large for a datagram with 100 values, the logger writes fewer per message
+            fd_test_logger<cw_emf::output_sink_udp> logger(socket);
+            for (int i=0; i < 120; ++i)
+                logger.put_metrics_value<0>(i + 0.123456789);
+            logger.log_value<0>(std::string(64000, 't'));
+        }
+        REQUIRE(socket.datagrams() == 4 + 3);
+        datagrams = agent.receive(3);
+        REQUIRE(datagrams.size() == 3);
+        values = 0;
+        for (auto& datagram: datagrams) {
+            REQUIRE(datagram.size() <= cw_emf::output_sink_udp::max_message_size());
+            values += nlohmann::json::parse(datagram)["latency_with_a_long_name"].size();
+        }
+        REQUIRE(values == 120);
+        REQUIRE(socket.errors() == 0);
+
+        REQUIRE_THROWS_AS(cw_emf::datagram_socket::udp("localhost"), std::invalid_argument);
+    }
+
+    SECTION("Unix datagrams") {
+        char directory[] = "/tmp/cw_emf_XXXXXX";
+        REQUIRE(::mkdtemp(directory) != nullptr);
+        std::string path = std::string(directory) + "/agent.sock";
+
+        {
+            ::sockaddr_un address{};
+            address.sun_family = AF_UNIX;
+            std::strcpy(address.sun_path, path.c_str());
+            datagram_listener agent(reinterpret_cast<::sockaddr*>(&address), sizeof(address));
+            auto socket = cw_emf::datagram_socket::unix_dgram(path);
+
+            std::vector<std::thread> threads;
+            for (int t=0; t < 4; ++t) {
+                threads.emplace_back([&socket, t] {
+                    for (int i=0; i < 25; ++i) {
+                        fd_test_logger<cw_emf::output_sink_unix_dgram> logger(socket);
+                        logger.put_metrics_value<1>(t * 100 + i);
+                    }
+                });
+            }
+            for (auto& thread: threads)
+                thread.join();
+
+            auto datagrams = agent.receive(100);
+            REQUIRE(datagrams.size() == 100);
+            std::vector<int> counts;
+            for (auto& datagram: datagrams)
+                counts.push_back(nlohmann::json::parse(datagram)["count"]);
+            std::sort(counts.begin(), counts.end());
+            for (int t=0; t < 4; ++t)
+                for (int i=0; i < 25; ++i)
+                    REQUIRE(counts[t * 25 + i] == t * 100 + i);
+            REQUIRE(socket.errors() == 0);
+        }
+        ::unlink(path.c_str());
+        ::rmdir(directory);
+
+        // Nobody listens
+        auto socket = cw_emf::datagram_socket::unix_dgram(path);
+        {
+            fd_test_logger<cw_emf::output_sink_unix_dgram> logger(socket);
+            logger.put_metrics_value<1>(1);
+        }
+        REQUIRE(socket.errors() == 1);
+    }
+
+    SECTION("TCP sink throughput") {
+        constexpr int threads = 4;
+        constexpr int loggers = 5000;
+        tcp_listener agent;
+        // Room for everything, the threads may append faster than the writer sends
+        cw_emf::tcp_writer writer("127.0.0.1", agent.port(), 1 << 24);
+
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> workers;
+        for (int t=0; t < threads; ++t) {
+            workers.emplace_back([&writer, t] {
+                for (int i=0; i < loggers; ++i) {
+                    fd_test_logger<cw_emf::output_sink_tcp> logger(writer);
+                    for (int value=0; value < 20; ++value)
+                        logger.put_metrics_value<0>(value * 1.5);
+                    logger.put_metrics_value<1>(i);
+                    logger.dimension_value<1>("thread_" + std::to_string(t));
+                }
+            });
+        }
+        for (auto& worker: workers)
+            worker.join();
+        REQUIRE(writer.flush(std::chrono::seconds(10)));
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        std::string content = agent.content(writer.bytes_sent());
+        REQUIRE(content.size() == writer.bytes_sent());
+        REQUIRE(writer.dropped() == 0);
+        REQUIRE(writer.reconnects() == 0);
+
+        std::vector<int> per_thread(threads);
+        for (auto& message: split_string_by_newline(content))
+            ++per_thread[std::stoi(message["request_id"].get<std::string>().substr(7))];
+        REQUIRE(per_thread == std::vector<int>(threads, loggers));
+
+        double megabytes_per_second = content.size() / 1e6 / elapsed.count();
+        INFO(megabytes_per_second << " MB/s");
+        REQUIRE(megabytes_per_second > 1);
+    }
+
+    SECTION("TCP sink without agent") {
+        std::uint16_t port = tcp_listener().port();
+        cw_emf::tcp_writer writer("127.0.0.1", port, 4096, std::chrono::milliseconds(10), std::chrono::milliseconds(50));
+
+        // Nobody listens, appending neither blocks nor grows the queue past its capacity
+        auto start = std::chrono::steady_clock::now();
+        for (int i=0; i < 100; ++i) {
+            fd_test_logger<cw_emf::output_sink_tcp> logger(writer);
+            logger.put_metrics_value<1>(i);
+        }
+        REQUIRE(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(500));
+        REQUIRE_FALSE(writer.connected());
+        REQUIRE(writer.dropped() > 0);
+        REQUIRE_FALSE(writer.flush(std::chrono::milliseconds(10)));
+
+        // The agent comes up and gets what was queued
+        tcp_listener agent(port);
+        REQUIRE(writer.flush(std::chrono::seconds(5)));
+        REQUIRE(split_string_by_newline(agent.content(writer.bytes_sent())).size() == 100 - writer.dropped());
+        REQUIRE(writer.reconnects() == 0);
+
+        // The connection breaks, the writer connects again
+        agent.drop_connection();
+        for (int i=0; i < 500 && writer.reconnects() == 0; ++i) {
+            fd_test_logger<cw_emf::output_sink_tcp> logger(writer);
+            logger.put_metrics_value<1>(i);
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        REQUIRE(writer.reconnects() == 1);
+        for (int i=0; i < 500 && agent.connections() < 2; ++i)
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        REQUIRE(agent.connections() == 2);
+    }
+
+    SECTION("Batched writes") {
+        temporary_file file;
+        std::size_t batches;
+        {
+            cw_emf::batch_writer writer(file.fd(), 4096, 50, std::chrono::seconds(10));
+
+            std::vector<std::thread> threads;
+            for (int t=0; t < 8; ++t) {
+                threads.emplace_back([&writer, t] {
+                    for (int i=0; i < 500; ++i) {
+                        posix_logger logger(writer);
+                        logger.put_metrics_value<0>(t * 1000 + i);
+                        logger.dimension_value<0>("thread_" + std::to_string(t));
+                    }
+                });
+            }
+            for (auto& thread: threads)
+                thread.join();
+
+            writer.flush();
+            batches = writer.batches();
+            REQUIRE(writer.errors() == 0);
+        }
+
+        auto test_data = split_string_by_newline(file.content());
+        REQUIRE(test_data.size() == 4000);
+        INFO("batches: " << batches);
+        REQUIRE(batches >= 4000 / 50);
+        REQUIRE(batches < 4000);
+
+        std::vector<int> per_thread(8);
+        for (auto& message: test_data) {
+            int value = message["latency"];
+            REQUIRE(message["request_id"] == "thread_" + std::to_string(value / 1000));
+            ++per_thread[value / 1000];
+        }
+        REQUIRE(per_thread == std::vector<int>(8, 500));
+    }
+
+    SECTION("Batch thresholds") {
+        temporary_file file;
+        cw_emf::batch_writer writer(file.fd(), 64, 1000, std::chrono::milliseconds(10));
+
+        writer.append("{\"a\":1}\n");
+        for (int i=0; i < 100 && file.content().empty(); ++i)
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        REQUIRE(file.content() == "{\"a\":1}\n");
+
+        writer.append(std::string(100, ' ') + "\n");
+        REQUIRE(file.content().size() == 8 + 101);
+
+        for (int i=0; i < 9; ++i)
+            writer.append("0123456789\n");
+        writer.flush();
+        REQUIRE(file.content().size() == 8 + 101 + 99);
+        REQUIRE(writer.batches() >= 3);
+    }
+}
+
+TEST_CASE("POSIX Sink Benchmark", "[benchmark]") {
+    int null = ::open("/dev/null", O_WRONLY);
+
+    BENCHMARK_ADVANCED("Per request logger, batch sink to /dev/null")(Catch::Benchmark::Chronometer meter) {
+        cw_emf::batch_writer writer(null);
+        meter.measure([&writer] {
+            posix_logger logger(writer);
+            for (int i=0; i < 20; ++i)
+                logger.put_metrics_value<0>(i * 1.5);
+            logger.dimension_value<0>("7c1c8a5e-4d1a-4a6f-9b0e-3f7c8d2e1a90");
+        });
+    };
+
+    ::close(null);
+
+    auto log_request = [](auto& logger) {
+        for (int i=0; i < 20; ++i)
+            logger.template put_metrics_value<0>(i * 1.5);
+        logger.template put_metrics_value<1>(3);
+        logger.template dimension_value<1>("7c1c8a5e-4d1a-4a6f-9b0e-3f7c8d2e1a90");
+        logger.template log_value<0>("a trace");
+    };
+
+    BENCHMARK_ADVANCED("Per request logger, stdout sink to a pipe")(Catch::Benchmark::Chronometer meter) {
+        draining_pipe pipe(false);
+        redirected_stdout redirect(pipe.fd());
+        meter.measure([&log_request] {
+            fd_test_logger<cw_emf::output_sink_stdout> logger;
+            log_request(logger);
+        });
+    };
+
+    BENCHMARK_ADVANCED("Per request logger, fd sink to a pipe")(Catch::Benchmark::Chronometer meter) {
+        draining_pipe pipe(false);
+        meter.measure([&log_request, &pipe] {
+            fd_test_logger<cw_emf::output_sink_fd> logger(pipe.fd());
+            log_request(logger);
+        });
+    };
+
+    BENCHMARK_ADVANCED("Per request logger, io_uring sink to a pipe")(Catch::Benchmark::Chronometer meter) {
+        draining_pipe pipe(false);
+        cw_emf::uring_writer writer(pipe.fd());
+        meter.measure([&log_request, &writer] {
+            fd_test_logger<cw_emf::output_sink_uring> logger(writer);
+            log_request(logger);
+        });
+    };
+
+    // Latency of each logger going out of scope, which is when it writes, and the system calls it takes
+    auto flush_latencies = [&log_request]<typename sink_t>(auto&&... args) {
+        constexpr int requests = 20000;
+        std::vector<std::chrono::nanoseconds> latencies;
+        for (int i=0; i < requests; ++i) {
+            std::optional<fd_test_logger<sink_t>> logger(std::in_place, args...);
+            log_request(*logger);
+            auto start = std::chrono::steady_clock::now();
+            logger.reset();
+            latencies.push_back(std::chrono::steady_clock::now() - start);
+        }
+        std::sort(latencies.begin(), latencies.end());
+        return std::pair(latencies[requests / 2], latencies[requests * 99 / 100]);
+    };
+
+    // Not sections, the benchmarks above would run again for each
+    {
+        draining_pipe pipe(false);
+        std::pair<std::chrono::nanoseconds, std::chrono::nanoseconds> stdout_latency, uring_latency;
+        std::size_t stdout_calls, uring_calls;
+        {
+            redirected_stdout redirect(pipe.fd());
+            std::size_t before = write_system_calls();
+            stdout_latency = flush_latencies.template operator()<cw_emf::output_sink_stdout>();
+            stdout_calls = write_system_calls() - before;
+        }
+        {
+            cw_emf::uring_writer writer(pipe.fd());
+            uring_latency = flush_latencies.template operator()<cw_emf::output_sink_uring>(std::ref(writer));
+            writer.flush();
+            uring_calls = writer.system_calls();
+        }
+
+        std::printf("stdout:   p50 %lld ns, p99 %lld ns, %zu write calls for 20000 requests\n",
+                    static_cast<long long>(stdout_latency.first.count()), static_cast<long long>(stdout_latency.second.count()), stdout_calls);
+        std::printf("io_uring: p50 %lld ns, p99 %lld ns, %zu io_uring_enter calls for 20000 requests\n",
+                    static_cast<long long>(uring_latency.first.count()), static_cast<long long>(uring_latency.second.count()), uring_calls);
+    }
+
+    // CPU time of the logging thread per MB of EMF written, and the bytes copied after rendering
+    auto cpu_per_mb = [](auto&& log_requests) {
+        auto cpu_time = [] {
+            ::rusage usage{};
+            ::getrusage(RUSAGE_THREAD, &usage);
+            return std::chrono::seconds(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec)
+                + std::chrono::microseconds(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+        };
+        auto start = cpu_time();
+        double megabytes = log_requests() / 1e6;
+        return std::chrono::duration<double, std::micro>(cpu_time() - start).count() / megabytes;
+    };
+    auto log_large_request = [](auto& logger, int i) {
+        for (int value=0; value < 50; ++value)
+            logger.template put_metrics_value<0>(value * 1.5);
+        logger.template put_metrics_value<1>(i);
+        logger.template dimension_value<1>("7c1c8a5e-4d1a-4a6f-9b0e-3f7c8d2e1a90");
+        logger.template log_value<0>(std::string(8000, 't'));
+    };
+    std::size_t message_size = [&log_large_request] {
+        std::string buffer;
+        {
+            fd_test_logger<cw_emf::output_sink_string> logger(buffer);
+            log_large_request(logger, 0);
+        }
+        return buffer.size();
+    }();
+
+    {
+        constexpr int requests = 20000;
+        draining_pipe pipe(false);
+        double stdout_cpu, vmsplice_cpu;
+        std::size_t spliced, written;
+        {
+            redirected_stdout redirect(pipe.fd());
+            stdout_cpu = cpu_per_mb([&log_large_request, message_size] {
+                for (int i=0; i < requests; ++i) {
+                    fd_test_logger<cw_emf::output_sink_stdout> logger;
+                    log_large_request(logger, i);
+                }
+                return requests * message_size;
+            });
+        }
+        {
+            cw_emf::vmsplice_writer writer(pipe.fd());
+            vmsplice_cpu = cpu_per_mb([&log_large_request, &writer, message_size] {
+                for (int i=0; i < requests; ++i) {
+                    fd_test_logger<cw_emf::output_sink_vmsplice> logger(writer);
+                    log_large_request(logger, i);
+                }
+                return requests * message_size;
+            });
+            spliced = writer.bytes_spliced();
+            written = writer.bytes_written();
+        }
+
+        // stdout copies each message into the stdio buffer and from there into the pipe
+        std::printf("stdout:   %.0f us CPU per MB, %zu bytes copied for %zu bytes of EMF\n",
+                    stdout_cpu, 2 * requests * message_size, requests * message_size);
+        std::printf("vmsplice: %.0f us CPU per MB, %zu bytes copied for %zu bytes of EMF, %zu spliced\n",
+                    vmsplice_cpu, written, requests * message_size, spliced);
+    }
+}
@@ -1,7 +1,17 @@
 #define CATCH_CONFIG_ENABLE_BENCHMARKING
 
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <future>
 #include <iostream>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <numeric>
+#include <regex>
 #include <sstream>
+#include <thread>
 #include <vector>
 
 #include "catch2.h"
@@ -21,6 +31,125 @@ std::vector<nlohmann::json> split_string_by_newline(const std::string& str)
     return result;
 }
 
+/**
+ * Calls of the global operator new, which also sees allocations that bypass the memory resources. The deletes are
+ * not inlined, GCC would otherwise see free() on a pointer from operator new and warn with -Wmismatched-new-delete.
+ */
+std::atomic<std::size_t> global_allocations{0};
+
+void* operator new(std::size_t size) {
+    global_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* memory = std::malloc(size ? size : 1))
+        return memory;
+    throw std::bad_alloc();
+}
+
+[[gnu::noinline]] void operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+
+[[gnu::noinline]] void operator delete(void* memory, std::size_t) noexcept {
+    std::free(memory);
+}
+
+// std::pmr::new_delete_resource allocates with the alignment
+void* operator new(std::size_t size, std::align_val_t alignment) {
+    global_allocations.fetch_add(1, std::memory_order_relaxed);
+    auto align = static_cast<std::size_t>(alignment);
+    if (void* memory = std::aligned_alloc(align, (std::max<std::size_t>(size, 1) + align - 1) / align * align))
+        return memory;
+    throw std::bad_alloc();
+}
+
+[[gnu::noinline]] void operator delete(void* memory, std::align_val_t) noexcept {
+    std::free(memory);
+}
+
+[[gnu::noinline]] void operator delete(void* memory, std::size_t, std::align_val_t) noexcept {
+    std::free(memory);
+}
+
+/**
+ * Counts the allocations it passes on to the new/delete resource
+ */
+class counting_resource: public std::pmr::memory_resource {
+public:
+    std::size_t allocations{0};
+
+private:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+        ++allocations;
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override {
+        std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+};
+
+/**
+ * A typical per request logger, 20 latency values spill out of the inline storage
+ */
+using request_logger = cw_emf::logger<"test_ns",
+        cw_emf::metrics<
+            cw_emf::metric<"latency", cw_emf::unit::Milliseconds>,
+            cw_emf::metric<"count", cw_emf::unit::Count, int>>,
+        cw_emf::dimensions<
+            cw_emf::dimension_fixed<"version", "$LATEST">,
+            cw_emf::dimension<"request_id">>,
+        cw_emf::log_messages<cw_emf::log_message<"tracing">>,
+        cw_emf::output_sink_pmr_string>;
+
+void log_request(request_logger& logger) {
+    for (int i=0; i < 20; ++i)
+        logger.put_metrics_value<"latency">(i * 1.5);
+    logger.put_metrics_value<"count">(20);
+    logger.dimension_value<"request_id">("7c1c8a5e-4d1a-4a6f-9b0e-3f7c8d2e1a90");
+    logger.log_value<"tracing">("request handled by the order service, all downstream calls succeeded");
+}
+
+/**
+ * Metric names m00 to m63 for the wide schema benchmarks
+ */
+constexpr std::size_t wide_metrics = 64;
+
+template<std::size_t index> constexpr auto wide_metric_name() {
+    const char name[] = {'m', char('0' + index / 10), char('0' + index % 10), '\0'};
+    return cw_emf::internal::named(name);
+}
+
+template<auto name> using wide_metric = cw_emf::metric<name, cw_emf::unit::Milliseconds>;
+template<auto name> using wide_bounded_metric = cw_emf::bounded_metric<name, cw_emf::unit::Milliseconds, 8>;
+
+/**
+ * Forwards to output_sink_string, but without taking pre-rendered fragments
+ */
+class output_sink_elements {
+public:
+    output_sink_elements(std::string& buffer): m_sink{buffer} {}
+
+    void open_root_object() { m_sink.open_root_object(); }
+    void close_root_object() { m_sink.close_root_object(); }
+    void open_object(auto&&... name) { m_sink.open_object(name...); }
+    void close_object() { m_sink.close_object(); }
+
+    void open_array(auto&&... name) { m_sink.open_array(name...); }
+    void close_array() { m_sink.close_array(); }
+
+    void write_next_element() { m_sink.write_next_element(); }
+    void write_value(auto&&... args) { m_sink.write_value(args...); }
+
+    void done() { m_sink.done(); }
+    bool generate() const { return m_sink.generate(); }
+
+private:
+    cw_emf::output_sink_string m_sink;
+};
+
 
 TEST_CASE("AWS Embedded Metrics Format", "[main]") {
 
@@ -67,7 +196,7 @@ TEST_CASE("AWS Embedded Metrics Format", "[main]") {
         {
             cw_emf::logger<"test_ns",
                     cw_emf::metrics<
-                            cw_emf::metric<"metric_1", Aws::CloudWatch::Model::StandardUnit::Count>>,
+                            cw_emf::metric<"metric_1", cw_emf::unit::Count>>,
                     cw_emf::dimensions<>,
                     cw_emf::log_messages<>,
                     cw_emf::output_sink_string> logger(buffer);
@@ -104,8 +233,8 @@ TEST_CASE("AWS Embedded Metrics Format", "[main]") {
         {
             cw_emf::logger<"test_ns",
                     cw_emf::metrics<
-                            cw_emf::metric<"metric_1", Aws::CloudWatch::Model::StandardUnit::Count>,
-                            cw_emf::metric<"metric_2", Aws::CloudWatch::Model::StandardUnit::Count>>,
+                            cw_emf::metric<"metric_1", cw_emf::unit::Count>,
+                            cw_emf::metric<"metric_2", cw_emf::unit::Count>>,
                     cw_emf::dimensions<>,
                     cw_emf::log_messages<>,
                     cw_emf::output_sink_string> logger(buffer);
@@ -197,7 +326,7 @@ TEST_CASE("AWS Embedded Metrics Format", "[main]") {
         {
             cw_emf::logger<"test_ns",
                     cw_emf::metrics<
-                        cw_emf::metric<"metric_1", Aws::CloudWatch::Model::StandardUnit::Count>>,
+                        cw_emf::metric<"metric_1", cw_emf::unit::Count>>,
                     cw_emf::dimensions<>,
                     cw_emf::log_messages<>,
                     cw_emf::output_sink_string> logger(buffer);
@@ -229,8 +358,8 @@ TEST_CASE("AWS Embedded Metrics Format", "[main]") {
         {
             cw_emf::logger<"test_ns",
                     cw_emf::metrics<
-                            cw_emf::metric<"metric_1", Aws::CloudWatch::Model::StandardUnit::Count>,
-                            cw_emf::metric<"metric_2", Aws::CloudWatch::Model::StandardUnit::Count>>,
+                            cw_emf::metric<"metric_1", cw_emf::unit::Count>,
+                            cw_emf::metric<"metric_2", cw_emf::unit::Count>>,
                     cw_emf::dimensions<>,
                     cw_emf::log_messages<>,
                     cw_emf::output_sink_string> logger(buffer);
@@ -268,6 +397,1093 @@ TEST_CASE("AWS Embedded Metrics Format", "[main]") {
     }
 
 
+    SECTION("Named access resolves to index") {
+        using test_metrics = cw_emf::metrics<
+                cw_emf::metric<"metric_1", cw_emf::unit::Count>,
+                cw_emf::metric<"metric_2", cw_emf::unit::Count>,
+                cw_emf::metric<"metric_10", cw_emf::unit::Count>>;
+
+        static_assert(cw_emf::internal::index_by_name<"metric_1", cw_emf::metric<"metric_1", cw_emf::unit::Count>, cw_emf::metric<"metric_10", cw_emf::unit::Count>>() == 0);
+        static_assert(cw_emf::internal::index_by_name<"metric_10", cw_emf::metric<"metric_1", cw_emf::unit::Count>, cw_emf::metric<"metric_10", cw_emf::unit::Count>>() == 1);
+        static_assert(cw_emf::internal::count_by_name<"metric_3", cw_emf::metric<"metric_1", cw_emf::unit::Count>>() == 0);
+
+        std::string by_name;
+        std::string by_index;
+        {
+            cw_emf::logger<"test_ns", test_metrics,
+                    cw_emf::dimensions<cw_emf::dimension<"request_id">>,
+                    cw_emf::log_messages<cw_emf::log_message<"tracing">>,
+                    cw_emf::output_sink_string> logger(by_name);
+
+            logger.put_metrics_value<"metric_10">(7);
+            logger.put_metrics_value<"metric_2">(3);
+            logger.put_metrics_value<"metric_1">(1);
+            logger.dimension_value<"request_id">("req_abs_123");
+            logger.log_value<"tracing">("Hallo World");
+        }
+        {
+            cw_emf::logger<"test_ns", test_metrics,
+                    cw_emf::dimensions<cw_emf::dimension<"request_id">>,
+                    cw_emf::log_messages<cw_emf::log_message<"tracing">>,
+                    cw_emf::output_sink_string> logger(by_index);
+
+            logger.put_metrics_value<2>(7);
+            logger.put_metrics_value<1>(3);
+            logger.put_metrics_value<0>(1);
+            logger.dimension_value<0>("req_abs_123");
+            logger.log_value<0>("Hallo World");
+        }
+
+        auto named_data = split_string_by_newline(by_name);
+        auto indexed_data = split_string_by_newline(by_index);
+        REQUIRE(named_data.size() == 1);
+        REQUIRE(indexed_data.size() == 1);
+
+        named_data[0]["_aws"].erase("Timestamp");
+        indexed_data[0]["_aws"].erase("Timestamp");
+        REQUIRE(named_data[0] == indexed_data[0]);
+        REQUIRE(7 == named_data[0]["metric_10"]);
+        REQUIRE(1 == named_data[0]["metric_1"]);
+    }
+
+
+    SECTION("Pre-rendered header matches element output") {
+        static_assert(!cw_emf::internal::emf_fragment_sink_c<output_sink_elements>);
+        static_assert(cw_emf::internal::emf_fragment_sink_c<cw_emf::output_sink_string>);
+
+        auto log = [](auto& logger) {
+            for (int i=0; i < 150; ++i)
+                logger.template put_metrics_value<"metric_2">(i);
+            logger.template put_metrics_value<"metric_3">(42);
+            logger.template dimension_value<"request_id">("req_abs_123");
+            logger.template log_value<"tracing">("Hallo World");
+        };
+
+        std::string fragments;
+        std::string elements;
+        {
+            cw_emf::logger<"test_ns",
+                    cw_emf::metrics<
+                        cw_emf::metric<"metric_1", cw_emf::unit::Count>,
+                        cw_emf::metric<"metric_2", cw_emf::unit::Milliseconds>,
+                        cw_emf::metric<"metric_3", cw_emf::unit::Bytes_Second>>,
+                    cw_emf::dimensions<
+                        cw_emf::dimension_fixed<"version", "$LATEST">,
+                        cw_emf::dimension<"request_id">>,
+                    cw_emf::log_messages<cw_emf::log_message<"tracing">>,
+                    cw_emf::output_sink_string> logger(fragments);
+            log(logger);
+        }
+        {
+            cw_emf::logger<"test_ns",
+                    cw_emf::metrics<
+                        cw_emf::metric<"metric_1", cw_emf::unit::Count>,
+                        cw_emf::metric<"metric_2", cw_emf::unit::Milliseconds>,
+                        cw_emf::metric<"metric_3", cw_emf::unit::Bytes_Second>>,
+                    cw_emf::dimensions<
+                        cw_emf::dimension_fixed<"version", "$LATEST">,
+                        cw_emf::dimension<"request_id">>,
+                    cw_emf::log_messages<cw_emf::log_message<"tracing">>,
+                    output_sink_elements> logger(elements);
+            log(logger);
+        }
+
+        std::regex timestamp("\"Timestamp\":[0-9]+");
+        REQUIRE(std::regex_replace(fragments, timestamp, "") == std::regex_replace(elements, timestamp, ""));
+
+        auto test_data = split_string_by_newline(fragments);
+        REQUIRE(test_data.size() == 2);
+        REQUIRE(test_data[0]["_aws"]["CloudWatchMetrics"][0]["Metrics"].size() == 2);
+        REQUIRE(test_data[1]["_aws"]["CloudWatchMetrics"][0]["Metrics"].size() == 1);
+        REQUIRE(test_data[1]["version"] == "$LATEST");
+        REQUIRE(test_data[1]["request_id"] == "req_abs_123");
+    }
+
+
+    SECTION("Unit names") {
+        static_assert(cw_emf::metric<"metric_1", cw_emf::unit::Count>::unit_name() == "Count");
+        static_assert(cw_emf::metric<"metric_1", cw_emf::unit::Gigabits_Second>::unit_name() == "Gigabits/Second");
+
+        REQUIRE(cw_emf::internal::unit_name(cw_emf::unit::Seconds) == "Seconds");
+        REQUIRE(cw_emf::internal::unit_name(cw_emf::unit::Percent) == "Percent");
+        REQUIRE(cw_emf::internal::unit_name(cw_emf::unit::Bytes_Second) == "Bytes/Second");
+        REQUIRE(cw_emf::internal::unit_name(cw_emf::unit::Terabits_Second) == "Terabits/Second");
+        REQUIRE(cw_emf::internal::unit_name(cw_emf::unit::Count_Second) == "Count/Second");
+        REQUIRE(cw_emf::internal::unit_name(cw_emf::unit::None) == "None");
+    }
+
+#if CW_EMF_AWS_SDK
+    SECTION("AWS SDK unit compatibility") {
+        using Aws::CloudWatch::Model::StandardUnit;
+
+        static_assert(cw_emf::metric<"metric_1", StandardUnit::Bytes_Second>::unit_name() == "Bytes/Second");
+
+        REQUIRE(cw_emf::internal::to_unit(StandardUnit::Seconds) == cw_emf::unit::Seconds);
+        REQUIRE(cw_emf::internal::to_unit(StandardUnit::Count) == cw_emf::unit::Count);
+        REQUIRE(cw_emf::internal::to_unit(StandardUnit::Terabits_Second) == cw_emf::unit::Terabits_Second);
+        REQUIRE(cw_emf::internal::to_unit(StandardUnit::Count_Second) == cw_emf::unit::Count_Second);
+        REQUIRE(cw_emf::internal::to_unit(StandardUnit::NOT_SET) == cw_emf::unit::None);
+    }
+#endif
+
+    SECTION("Number formatting") {
+        std::string buffer;
+        {
+            cw_emf::logger<"test_ns",
+                    cw_emf::metrics<
+                        cw_emf::metric<"shortest", cw_emf::unit::None>,
+                        cw_emf::metric<"fixed", cw_emf::unit::Milliseconds, double, cw_emf::precision<2>>,
+                        cw_emf::metric<"integer", cw_emf::unit::Count, std::int64_t, cw_emf::precision<2>>>,
+                    cw_emf::dimensions<>,
+                    cw_emf::log_messages<>,
+                    cw_emf::output_sink_string> logger(buffer);
+
+            logger.put_metrics_value<"shortest">(3.1415926);
+            logger.put_metrics_value<"shortest">(1e-9);
+            logger.put_metrics_value<"shortest">(1e12);
+            logger.put_metrics_value<"shortest">(-0.1);
+            logger.put_metrics_value<"fixed">(3.1415926);
+            logger.put_metrics_value<"integer">(std::numeric_limits<std::int64_t>::min());
+        }
+
+        REQUIRE(buffer.find("\"shortest\": [3.1415926,1e-09,1e+12,-0.1]") != std::string::npos);
+        REQUIRE(buffer.find("\"fixed\":3.14") != std::string::npos);
+        REQUIRE(buffer.find("\"integer\":-9223372036854775808") != std::string::npos);
+
+        auto test_data = split_string_by_newline(buffer);
+        REQUIRE(test_data.size() == 1);
+        REQUIRE(3.1415926 == test_data[0]["shortest"][0]);
+        REQUIRE(1e-9 == test_data[0]["shortest"][1]);
+
+        std::string extremes;
+        cw_emf::output_sink_string sink(extremes);
+        sink.write_value(-std::numeric_limits<double>::max());
+        sink.write_value(-std::numeric_limits<double>::denorm_min());
+        sink.write_value(-std::numeric_limits<double>::max(), cw_emf::precision<17>::number_format);
+        sink.write_value(std::numeric_limits<std::uint64_t>::max());
+        REQUIRE(extremes.starts_with("-1.7976931348623157e+308-5e-324-179769313486231570"));
+        REQUIRE(extremes.ends_with(".0000000000000000018446744073709551615"));
+    }
+
+
+    SECTION("String escaping") {
+        std::string special;
+        for (char c=0; c < 0x20; ++c)
+            special += c;
+        special += "\"\\/ h\u00e9llo \u20ac \U0001F600";
+
+        // escapes at every offset around the 16 and 32 byte runs
+        std::vector<std::string> values{special, std::string(200, 'x')};
+        for (std::size_t offset=0; offset < 70; ++offset) {
+            auto value = std::string(100, 'a');
+            value[offset] = '"';
+            value[offset + 1] = '\n';
+            values.push_back(value);
+        }
+
+        for (const auto& value: values) {
+            std::string buffer;
+            {
+                cw_emf::logger<"test_ns",
+                        cw_emf::metrics<>,
+                        cw_emf::dimensions<cw_emf::dimension<"request_id">>,
+                        cw_emf::log_messages<cw_emf::log_message<"tracing">>,
+                        cw_emf::output_sink_string> logger(buffer);
+
+                logger.dimension_value<"request_id">(value);
+                logger.log_value<"tracing">(value);
+            }
+
+            auto test_data = split_string_by_newline(buffer);
+            REQUIRE(test_data.size() == 1);
+            REQUIRE(test_data[0]["request_id"] == value);
+            REQUIRE(test_data[0]["tracing"] == value);
+            REQUIRE(cw_emf::internal::find_escape(value, true) == cw_emf::internal::find_escape_scalar(value, true));
+            REQUIRE(cw_emf::internal::find_escape(value, false) == cw_emf::internal::find_escape_scalar(value, false));
+        }
+
+        std::string unchecked;
+        std::string validated;
+        std::string invalid = std::string(40, 'a') + "\xC3\x28 \xE2\x82 \xED\xA0\x80 \xF8 \xC3\xA9";
+
+        cw_emf::output_sink_string(unchecked).write_value(std::string_view(invalid));
+        cw_emf::output_sink_string(validated, true).write_value(std::string_view(invalid));
+
+        REQUIRE(unchecked == "\"" + invalid + "\"");
+        REQUIRE(validated == "\"" + std::string(40, 'a') + "\uFFFD( \uFFFD\uFFFD \uFFFD\uFFFD\uFFFD \uFFFD \u00e9\"");
+        REQUIRE(nlohmann::json::parse(validated) == std::string(40, 'a') + "\uFFFD( \uFFFD\uFFFD \uFFFD\uFFFD\uFFFD \uFFFD \u00e9");
+
+        static_assert(cw_emf::internal::json_string("a\"b") == "\"a\\\"b\"");
+
+        // Names written element by element are escaped like values
+        std::string elements;
+        cw_emf::output_sink_string sink(elements);
+        sink.open_root_object();
+        sink.open_object("a\"b");
+        sink.write_value("c\\d", 1);
+        sink.write_next_element();
+        sink.write_value("e\nf", std::string_view("g"));
+        sink.close_object();
+        sink.write_next_element();
+        sink.open_array("h\"");
+        sink.close_array();
+        sink.close_root_object();
+
+        auto parsed = nlohmann::json::parse(elements);
+        REQUIRE(parsed["a\"b"]["c\\d"] == 1);
+        REQUIRE(parsed["a\"b"]["e\nf"] == "g");
+        REQUIRE(parsed["h\""].empty());
+    }
+
+
+    SECTION("Inline metric values") {
+        cw_emf::internal::small_vector<int, 4> values;
+        for (int i=0; i < 4; ++i)
+            values.push_back(i);
+
+        REQUIRE(values.is_inline());
+        REQUIRE(values.size() == 4);
+
+        auto copy = values;
+        REQUIRE(copy.is_inline());
+        REQUIRE(std::equal(copy.begin(), copy.end(), values.begin(), values.end()));
+
+        values.push_back(4);
+        REQUIRE_FALSE(values.is_inline());
+        REQUIRE(values.size() == 5);
+        REQUIRE(values.at(4) == 4);
+        REQUIRE_THROWS_AS(values.at(5), std::out_of_range);
+
+        auto moved = std::move(values);
+        REQUIRE_FALSE(moved.is_inline());
+        REQUIRE(values.is_inline());
+        REQUIRE(values.size() == 0);
+        for (int i=0; i < 5; ++i)
+            REQUIRE(moved[i] == i);
+
+        copy = moved;
+        REQUIRE(copy.size() == 5);
+        moved = std::move(copy);
+        REQUIRE(moved.size() == 5);
+        REQUIRE(moved[4] == 4);
+
+        cw_emf::internal::small_vector<double, 0> heap_only;
+        heap_only.push_back(1.5);
+        REQUIRE(heap_only[0] == 1.5);
+
+        std::string buffer;
+        {
+            cw_emf::logger<"test_ns",
+                    cw_emf::metrics<
+                        cw_emf::metric<"metric_1", cw_emf::unit::Count, int, cw_emf::inline_capacity<2>>>,
+                    cw_emf::dimensions<>,
+                    cw_emf::log_messages<>,
+                    cw_emf::output_sink_string> logger(buffer);
+
+            for (int i=0; i < 3; ++i)
+                logger.put_metrics_value<0>(i);
+        }
+
+        auto test_data = split_string_by_newline(buffer);
+        REQUIRE(test_data[0]["metric_1"] == nlohmann::json::array({0, 1, 2}));
+    }
+
+
+    SECTION("Bounded metrics") {
+        cw_emf::bounded_metric<"dropped", cw_emf::unit::Count, 3, int> dropped;
+        cw_emf::bounded_metric<"overwritten", cw_emf::unit::Count, 3, int, cw_emf::overflow::overwrite_oldest> overwritten;
+        cw_emf::bounded_metric<"counted", cw_emf::unit::Count, 3, int, cw_emf::overflow::count> counted;
+
+        for (int i=0; i < 5; ++i) {
+            dropped.put_value(i);
+            overwritten.put_value(i);
+            counted.put_value(i);
+        }
+
+        REQUIRE(dropped.size() == 3);
+        REQUIRE(dropped.value_at(2) == 2);
+        REQUIRE(overwritten.size() == 3);
+        REQUIRE(overwritten.value_at(0) == 2);
+        REQUIRE(overwritten.value_at(2) == 4);
+        REQUIRE(counted.size() == 3);
+        REQUIRE(counted.value_at(2) == 2);
+        REQUIRE(counted.overflows() == 2);
+        REQUIRE_THROWS_AS(counted.value_at(3), std::out_of_range);
+
+        using test_logger = cw_emf::logger<"test_ns",
+                cw_emf::metrics<
+                    cw_emf::bounded_metric<"latency", cw_emf::unit::Milliseconds, 150>,
+                    cw_emf::bounded_metric<"count", cw_emf::unit::Count, 1, std::int64_t>,
+                    cw_emf::bounded_metric<"ratio", cw_emf::unit::Percent, 2, float, cw_emf::overflow::drop, cw_emf::precision<3>>>,
+                cw_emf::dimensions<
+                    cw_emf::dimension_fixed<"version", "$LATEST">,
+                    cw_emf::dimension<"request_id">>,
+                cw_emf::log_messages<cw_emf::log_message<"tracing">>,
+                cw_emf::output_sink_string>;
+
+        constexpr std::size_t max_value_size = 16;
+        static_assert(test_logger::max_output_size(max_value_size) == 2 * test_logger::max_message_size(max_value_size));
+
+        std::string buffer;
+        buffer.reserve(test_logger::max_output_size(max_value_size));
+        auto data = buffer.data();
+        {
+            test_logger logger(buffer);
+
+            for (int i=0; i < 150; ++i)
+                logger.put_metrics_value<"latency">(-2.2250738585072014e-308);
+            logger.put_metrics_value<"count">(std::numeric_limits<std::int64_t>::min());
+            logger.put_metrics_value<"ratio">(-std::numeric_limits<float>::max());
+            logger.put_metrics_value<"ratio">(-std::numeric_limits<float>::max());
+
+            logger.dimension_value<"request_id">(std::string(max_value_size, '\x01'));
+            logger.log_value<"tracing">(std::string(max_value_size, '\x01'));
+        }
+
+        REQUIRE(buffer.data() == data);
+        REQUIRE(buffer.size() <= test_logger::max_output_size(max_value_size));
+
+        auto test_data = split_string_by_newline(buffer);
+        REQUIRE(test_data.size() == 2);
+        REQUIRE(buffer.find('\n') + 1 <= test_logger::max_message_size(max_value_size));
+        REQUIRE(test_data[0]["latency"].size() == 100);
+        REQUIRE(test_data[1]["latency"].size() == 50);
+    }
+
+    SECTION("Exactly 100 values") {
+        std::string buffer;
+        {
+            cw_emf::logger<"test_ns",
+                    cw_emf::metrics<cw_emf::metric<"metric_1", cw_emf::unit::Count>>,
+                    cw_emf::dimensions<>,
+                    cw_emf::log_messages<>,
+                    cw_emf::output_sink_string> logger(buffer);
+
+            for (int i=0; i < 100; ++i)
+                logger.put_metrics_value<0>(i);
+        }
+
+        REQUIRE(split_string_by_newline(buffer).size() == 1);
+    }
+
+
+    SECTION("Memory resource") {
+        counting_resource heap;
+        auto previous = std::pmr::set_default_resource(&heap);
+
+        std::pmr::string default_buffer;
+        {
+            request_logger logger(default_buffer);
+            log_request(logger);
+        }
+        auto default_allocations = heap.allocations;
+
+        heap.allocations = 0;
+        std::array<std::byte, 8192> stack;
+        std::pmr::monotonic_buffer_resource arena(stack.data(), stack.size(), &heap);
+        std::pmr::string arena_buffer(&arena);
+        auto global_before = global_allocations.load();
+        {
+            request_logger logger(std::allocator_arg, &arena, arena_buffer);
+            log_request(logger);
+        }
+        auto arena_global_allocations = global_allocations.load() - global_before;
+        auto arena_allocations = heap.allocations;
+
+        std::pmr::set_default_resource(previous);
+
+        INFO("allocations per request, default resource: " << default_allocations << ", monotonic buffer: " << arena_allocations
+             << ", global operator new with the monotonic buffer: " << arena_global_allocations);
+        REQUIRE(default_allocations > 0);
+        REQUIRE(arena_allocations == 0);
+        REQUIRE(arena_global_allocations == 0);
+
+        auto test_data = split_string_by_newline(std::string(arena_buffer));
+        REQUIRE(test_data.size() == 1);
+        REQUIRE(test_data[0]["latency"].size() == 20);
+        REQUIRE(test_data[0]["request_id"] == "7c1c8a5e-4d1a-4a6f-9b0e-3f7c8d2e1a90");
+
+        cw_emf::internal::small_vector<int, 1> arena_values(&arena);
+        arena_values.push_back(1);
+        arena_values.push_back(2);
+        cw_emf::internal::small_vector<int, 1> default_values;
+        default_values = std::move(arena_values);
+        REQUIRE(default_values.size() == 2);
+        REQUIRE(default_values.resource() == std::pmr::get_default_resource());
+        REQUIRE(arena_values.resource() == &arena);
+
+        // The resource must not end up in validate_utf8, the bytes are passed through unchanged
+        std::pmr::string raw_buffer;
+        {
+            request_logger logger(std::allocator_arg, &arena, raw_buffer);
+            logger.log_value<"tracing">("caf\xC3");
+        }
+        REQUIRE(raw_buffer.find("\"caf\xC3\"") != std::string::npos);
+    }
+
+    SECTION("Packed metrics") {
+        using test_metrics = std::tuple<
+                cw_emf::bounded_metric<"latency", cw_emf::unit::Milliseconds, 150>,
+                cw_emf::bounded_metric<"flag", cw_emf::unit::None, 2, std::int8_t, cw_emf::overflow::overwrite_oldest>,
+                cw_emf::bounded_metric<"count", cw_emf::unit::Count, 3, std::int64_t, cw_emf::overflow::count>,
+                cw_emf::bounded_metric<"ratio", cw_emf::unit::Percent, 2, float, cw_emf::overflow::drop, cw_emf::precision<3>>>;
+
+        auto log = [](auto& logger) {
+            for (int i=0; i < 160; ++i)
+                logger.template put_metrics_value<"latency">(i * 0.5);
+            for (int i=0; i < 7; ++i) {
+                logger.template put_metrics_value<"flag">(i);
+                logger.template put_metrics_value<"count">(i * 1000000000000);
+                logger.template put_metrics_value<"ratio">(i / 3.0f);
+            }
+        };
+
+        auto output = [&]<template<typename...> typename metrics_t>() {
+            std::string buffer;
+            {
+                cw_emf::logger<"test_ns",
+                        decltype(std::apply([](auto... m) { return metrics_t<decltype(m)...>(); }, test_metrics{})),
+                        cw_emf::dimensions<>,
+                        cw_emf::log_messages<>,
+                        cw_emf::output_sink_string> logger(buffer);
+                log(logger);
+            }
+            return buffer;
+        };
+        auto strip_timestamp = [](const std::string& buffer) {
+            return std::regex_replace(buffer, std::regex("\"Timestamp\":[0-9]+"), "");
+        };
+
+        auto packed = output.template operator()<cw_emf::packed_metrics>();
+        REQUIRE(strip_timestamp(packed) == strip_timestamp(output.template operator()<cw_emf::metrics>()));
+
+        auto test_data = split_string_by_newline(packed);
+        REQUIRE(test_data.size() == 2);
+        REQUIRE(test_data[0]["latency"].size() == 100);
+        REQUIRE(test_data[1]["latency"].size() == 50);
+        REQUIRE(test_data[0]["flag"] == std::vector<int>{5, 6});
+        REQUIRE(test_data[0]["count"] == std::vector<std::int64_t>{0, 1000000000000, 2000000000000});
+
+        cw_emf::packed_metrics<
+                cw_emf::bounded_metric<"flag", cw_emf::unit::None, 3, std::int8_t, cw_emf::overflow::overwrite_oldest>,
+                cw_emf::bounded_metric<"count", cw_emf::unit::Count, 2, int, cw_emf::overflow::count>> metrics;
+        for (int i=0; i < 1000; ++i) {
+            metrics.put_value<0>(i % 100);
+            metrics.put_value<1>(i);
+        }
+        REQUIRE(metrics.metric_at<0>().size() == 3);
+        REQUIRE(metrics.metric_at<0>().value_at(0) == 97);
+        REQUIRE(metrics.metric_at<0>().value_at(2) == 99);
+        REQUIRE(metrics.metric_at<1>().value_at(1) == 1);
+        REQUIRE(metrics.metric_at<1>().overflows() == 998);
+        REQUIRE_THROWS_AS(metrics.metric_at<1>().value_at(2), std::out_of_range);
+    }
+
+    SECTION("Values and counts") {
+        auto log = [](auto& logger) {
+            for (int i=0; i < 300; ++i)
+                logger.template put_metrics_value<"status">(i % 3 == 0 ? 500 : 200);
+            for (int i=150; i > 0; --i)
+                logger.template put_metrics_value<"latency">(i * 0.5);
+            logger.template put_metrics_value<"latency">(1.0);
+        };
+
+        std::string fragments;
+        std::string elements;
+        {
+            cw_emf::logger<"test_ns",
+                    cw_emf::metrics<
+                        cw_emf::metric<"status", cw_emf::unit::None, int, cw_emf::values_counts>,
+                        cw_emf::metric<"latency", cw_emf::unit::Milliseconds, double, cw_emf::values_counts, cw_emf::precision<1>>>,
+                    cw_emf::dimensions<>,
+                    cw_emf::log_messages<>,
+                    cw_emf::output_sink_string> logger(fragments);
+            log(logger);
+        }
+        {
+            cw_emf::logger<"test_ns",
+                    cw_emf::metrics<
+                        cw_emf::metric<"status", cw_emf::unit::None, int, cw_emf::values_counts>,
+                        cw_emf::metric<"latency", cw_emf::unit::Milliseconds, double, cw_emf::values_counts, cw_emf::precision<1>>>,
+                    cw_emf::dimensions<>,
+                    cw_emf::log_messages<>,
+                    output_sink_elements> logger(elements);
+            log(logger);
+        }
+
+        std::regex timestamp("\"Timestamp\":[0-9]+");
+        REQUIRE(std::regex_replace(fragments, timestamp, "") == std::regex_replace(elements, timestamp, ""));
+
+        auto test_data = split_string_by_newline(fragments);
+        REQUIRE(test_data.size() == 2);
+        REQUIRE(test_data[0]["status"]["Values"] == std::vector<int>{200, 500});
+        REQUIRE(test_data[0]["status"]["Counts"] == std::vector<int>{200, 100});
+        REQUIRE(!test_data[1].contains("status"));
+        REQUIRE(test_data[0]["latency"]["Values"].size() == 100);
+        REQUIRE(test_data[0]["latency"]["Values"][0] == 0.5);
+        REQUIRE(test_data[0]["latency"]["Counts"][1] == 2);
+        REQUIRE(test_data[1]["latency"]["Counts"].size() == 50);
+        REQUIRE(test_data[1]["latency"]["Values"][49] == 75.0);
+
+        cw_emf::metric<"status", cw_emf::unit::None, int, cw_emf::values_counts> status;
+        status.put_value(1);
+        REQUIRE(status.count_at(0) == 1);
+        REQUIRE_THROWS_AS(status.count_at(1), std::out_of_range);
+
+        // NaN would break the order of the values
+        cw_emf::metric<"latency", cw_emf::unit::Milliseconds, double, cw_emf::values_counts> latency;
+        for (double value: {2.0, std::numeric_limits<double>::quiet_NaN(), 1.0, std::numeric_limits<double>::quiet_NaN(), 2.0, 3.0})
+            latency.put_value(value);
+        REQUIRE(latency.size() == 3);
+        REQUIRE(latency.value_at(0) == 1.0);
+        REQUIRE(latency.value_at(1) == 2.0);
+        REQUIRE(latency.count_at(1) == 2);
+        REQUIRE(latency.value_at(2) == 3.0);
+        static_assert(cw_emf::internal::emf_counted_metric_c<decltype(status)>);
+        static_assert(!cw_emf::internal::emf_counted_metric_c<cw_emf::metric<"status", cw_emf::unit::None, int>>);
+    }
+
+    SECTION("Histogram metrics") {
+        using latency_t = cw_emf::histogram_metric<"latency", cw_emf::unit::Milliseconds>;
+        static_assert(cw_emf::internal::emf_counted_metric_c<latency_t>);
+
+        latency_t latency;
+        latency.put_value(0);
+        latency.put_value(-1);
+        latency.put_value(1);
+        latency.put_value(1.03);
+        latency.put_value(1e-30);
+        latency.put_value(std::numeric_limits<double>::infinity());
+
+        REQUIRE(latency.size() == 4);
+        REQUIRE(latency.value_at(0) == 0);
+        REQUIRE(latency.count_at(0) == 2);
+        REQUIRE(latency.value_at(1) == std::ldexp(1 + 0.5 / 16, -20));
+        REQUIRE(latency.value_at(2) == 1 + 0.5 / 16);
+        REQUIRE(latency.count_at(2) == 2);
+        REQUIRE(latency.value_at(3) == std::ldexp(1 + 15.5 / 16, 39));
+        REQUIRE(latency.value_at(1) == std::ldexp(1 + 0.5 / 16, -20));
+        REQUIRE_THROWS_AS(latency.value_at(4), std::out_of_range);
+
+        // Counts stop at 2^32 - 1 instead of wrapping around to an empty bucket
+        latency_t saturated;
+        saturated.put_value(1);
+        for (int i=0; i < 40; ++i) {
+            auto copy = saturated;
+            saturated.merge(copy);
+        }
+        saturated.put_value(1);
+        REQUIRE(saturated.size() == 1);
+        REQUIRE(saturated.count_at(0) == std::numeric_limits<std::uint32_t>::max());
+
+        std::string buffer;
+        {
+            cw_emf::logger<"test_ns",
+                    cw_emf::metrics<cw_emf::histogram_metric<"latency", cw_emf::unit::Milliseconds, 3>>,
+                    cw_emf::dimensions<>,
+                    cw_emf::log_messages<>,
+                    cw_emf::output_sink_string> logger(buffer);
+
+            for (int i=0; i < 100000; ++i)
+                logger.put_metrics_value<0>(1 + i % 1000);
+        }
+
+        auto test_data = split_string_by_newline(buffer);
+        REQUIRE(test_data.size() == 1);
+        auto values = test_data[0]["latency"]["Values"].get<std::vector<double>>();
+        auto counts = test_data[0]["latency"]["Counts"].get<std::vector<std::size_t>>();
+        REQUIRE(values.size() == counts.size());
+        REQUIRE(std::is_sorted(values.begin(), values.end()));
+        REQUIRE(std::accumulate(counts.begin(), counts.end(), std::size_t{0}) == 100000);
+        double sum = std::inner_product(values.begin(), values.end(), counts.begin(), 0.0);
+        REQUIRE(std::abs(sum - 100 * 500500.0) <= 100 * 500500.0 / 16);
+    }
+
+    SECTION("Sketch metrics") {
+        using latency_t = cw_emf::sketch_metric<"latency", cw_emf::unit::Milliseconds>;
+        static_assert(cw_emf::internal::emf_counted_metric_c<latency_t>);
+
+        auto quantile = [](const auto& metric, double q) {
+            std::size_t total{0};
+            for (std::size_t i=0; i < metric.size(); ++i)
+                total += metric.count_at(i);
+
+            std::size_t rank = static_cast<std::size_t>(q * (total - 1));
+            for (std::size_t i=0, seen=0; i < metric.size(); ++i) {
+                seen += metric.count_at(i);
+                if (seen > rank)
+                    return metric.value_at(i);
+            }
+            return metric.value_at(metric.size() - 1);
+        };
+
+        latency_t all;
+        latency_t first;
+        latency_t second;
+        for (int i=1; i <= 100000; ++i) {
+            all.put_value(100 + i);
+            (i % 2 ? first : second).put_value(100 + i);
+        }
+        first.merge(second);
+
+        REQUIRE(first.size() == all.size());
+        for (std::size_t i=0; i < all.size(); ++i) {
+            REQUIRE(first.value_at(i) == all.value_at(i));
+            REQUIRE(first.count_at(i) == all.count_at(i));
+        }
+        for (double q: {0.0, 0.5, 0.99, 1.0}) {
+            double expected = 101 + q * 99999;
+            REQUIRE(std::abs(quantile(all, q) - expected) <= expected * 0.01);
+        }
+
+        latency_t mixed;
+        for (double value: {-1000.0, -1.0, 0.0, 0.0, 5.0})
+            mixed.put_value(value);
+        REQUIRE(mixed.size() == 4);
+        REQUIRE(mixed.value_at(0) == Approx(-1000).epsilon(0.01));
+        REQUIRE(mixed.value_at(1) == Approx(-1).epsilon(0.01));
+        REQUIRE(mixed.value_at(2) == 0);
+        REQUIRE(mixed.count_at(2) == 2);
+        REQUIRE(mixed.value_at(3) == Approx(5).epsilon(0.01));
+        REQUIRE_THROWS_AS(mixed.value_at(4), std::out_of_range);
+
+        // Infinities share the bucket of the largest finite values
+        latency_t extreme;
+        for (double value: {std::numeric_limits<double>::max(), std::numeric_limits<double>::infinity(),
+                            -std::numeric_limits<double>::infinity(), std::numeric_limits<double>::quiet_NaN()})
+            extreme.put_value(value);
+        REQUIRE(extreme.size() == 3);
+        REQUIRE(extreme.count_at(0) == 1);
+        REQUIRE(extreme.value_at(0) < -1e307);
+        REQUIRE(std::isfinite(extreme.value_at(0)));
+        REQUIRE(extreme.value_at(1) == 0);
+        REQUIRE(extreme.count_at(2) == 2);
+        REQUIRE(extreme.value_at(2) > 1e307);
+        REQUIRE(std::isfinite(extreme.value_at(2)));
+
+        cw_emf::sketch_metric<"latency", cw_emf::unit::Milliseconds, 1e-6> precise;
+        precise.put_value(std::numeric_limits<double>::infinity());
+        precise.put_value(1e-300);
+        REQUIRE(precise.size() == 2);
+        REQUIRE(std::isfinite(precise.value_at(1)));
+
+        cw_emf::sketch_metric<"latency", cw_emf::unit::Milliseconds, 0.01, 16> collapsed;
+        for (int i=1; i <= 100000; ++i)
+            collapsed.put_value(i);
+        REQUIRE(collapsed.size() == 16);
+        REQUIRE(quantile(collapsed, 0.0) <= 100000 / std::pow(1.0202, 15));
+        REQUIRE(quantile(collapsed, 1.0) == Approx(100000).epsilon(0.01));
+        REQUIRE(quantile(collapsed, 0.99) == Approx(99000).epsilon(0.01));
+
+        std::string buffer;
+        {
+            cw_emf::logger<"test_ns",
+                    cw_emf::metrics<latency_t>,
+                    cw_emf::dimensions<>,
+                    cw_emf::log_messages<>,
+                    cw_emf::output_sink_string> logger(buffer);
+
+            for (int i=1; i <= 100000; ++i)
+                logger.put_metrics_value<0>(100 + i);
+        }
+
+        auto test_data = split_string_by_newline(buffer);
+        std::size_t total{0};
+        for (auto& message: test_data)
+            for (auto& count: message["latency"]["Counts"])
+                total += count.get<std::size_t>();
+        REQUIRE(test_data.size() == (all.size() + 99) / 100);
+        REQUIRE(total == 100000);
+    }
+
+    SECTION("Statistic set metrics") {
+        using latency_t = cw_emf::stat_metric<"latency", cw_emf::unit::Milliseconds>;
+        static_assert(cw_emf::internal::emf_counted_metric_c<latency_t>);
+        static_assert(sizeof(latency_t) == 40);
+
+        latency_t latency;
+        REQUIRE(latency.size() == 0);
+        latency.put_value(4);
+        REQUIRE(latency.size() == 1);
+        REQUIRE(latency.value_at(0) == 4);
+        latency.put_value(4);
+        REQUIRE(latency.size() == 1);
+        REQUIRE(latency.count_at(0) == 2);
+        latency.put_value(1);
+        REQUIRE(latency.size() == 3);
+        REQUIRE(latency.value_at(0) == 1);
+        REQUIRE(latency.value_at(1) == 4);
+        REQUIRE(latency.count_at(1) == 1);
+        REQUIRE(latency.value_at(2) == 4);
+        REQUIRE_THROWS_AS(latency.value_at(3), std::out_of_range);
+
+        cw_emf::stat_metric<"size", cw_emf::unit::Bytes, int> size;
+        size.put_value(2);
+        size.put_value(-3);
+        REQUIRE(size.size() == 2);
+        REQUIRE(size.value_at(0) == -3);
+        REQUIRE(size.value_at(1) == 2);
+        REQUIRE(size.sum() == -1);
+
+        // The value in between is not lost next to a large minimum and maximum
+        cw_emf::stat_metric<"offset", cw_emf::unit::None, std::int64_t> offset;
+        for (std::int64_t value: {-(std::int64_t{1} << 60), std::int64_t{1000}, std::int64_t{1} << 60})
+            offset.put_value(value);
+        REQUIRE(offset.value_at(1) == 1000);
+        REQUIRE(offset.sum() == 1000);
+
+        cw_emf::stat_metric<"offset", cw_emf::unit::None, std::uint64_t> unsigned_offset;
+        for (std::uint64_t value: {std::numeric_limits<std::uint64_t>::max(), std::uint64_t{7}, std::numeric_limits<std::uint64_t>::max()})
+            unsigned_offset.put_value(value);
+        unsigned_offset.put_value(std::numeric_limits<std::uint64_t>::max() - 1);
+        REQUIRE(unsigned_offset.value_at(1) == Approx(static_cast<double>(std::numeric_limits<std::uint64_t>::max())));
+        REQUIRE(unsigned_offset.sum() == Approx(3 * static_cast<double>(std::numeric_limits<std::uint64_t>::max())));
+
+        latency_t cancelling;
+        for (double value: {1e16, 1.0, -1e16})
+            cancelling.put_value(value);
+        REQUIRE(cancelling.value_at(1) == 1);
+        REQUIRE(cancelling.sum() == 1);
+
+        latency_t merged;
+        merged.put_value(-1e16);
+        merged.merge(cancelling);
+        REQUIRE(merged.sum() == 1 - 1e16);
+
+        std::string buffer;
+        {
+            cw_emf::logger<"test_ns",
+                    cw_emf::metrics<
+                        cw_emf::stat_metric<"latency", cw_emf::unit::Milliseconds>,
+                        cw_emf::stat_metric<"size", cw_emf::unit::Bytes, int>>,
+                    cw_emf::dimensions<>,
+                    cw_emf::log_messages<>,
+                    cw_emf::output_sink_string> logger(buffer);
+
+            for (int i=1; i <= 1000; ++i) {
+                logger.put_metrics_value<"latency">(i * 0.5);
+                logger.put_metrics_value<"size">(i);
+            }
+        }
+
+        auto test_data = split_string_by_newline(buffer);
+        REQUIRE(test_data.size() == 1);
+        REQUIRE(test_data[0]["latency"]["Values"] == std::vector<double>{0.5, 250.25, 500});
+        REQUIRE(test_data[0]["latency"]["Counts"] == std::vector<int>{1, 998, 1});
+        REQUIRE(test_data[0]["size"]["Values"] == std::vector<double>{1, 500.5, 1000});
+    }
+
+    SECTION("Atomic counter and gauge metrics") {
+        static_assert(sizeof(cw_emf::counter_metric<"requests", cw_emf::unit::Count>) == cw_emf::internal::cache_line_size);
+        static_assert(alignof(cw_emf::gauge_metric<"queue_depth", cw_emf::unit::Count>) == cw_emf::internal::cache_line_size);
+
+        std::string buffer;
+        {
+            cw_emf::logger<"test_ns",
+                    cw_emf::metrics<
+                        cw_emf::counter_metric<"requests", cw_emf::unit::Count>,
+                        cw_emf::counter_metric<"bytes", cw_emf::unit::Bytes, double>,
+                        cw_emf::gauge_metric<"queue_depth", cw_emf::unit::Count, int>,
+                        cw_emf::gauge_metric<"unset", cw_emf::unit::Count>>,
+                    cw_emf::dimensions<>,
+                    cw_emf::log_messages<>,
+                    cw_emf::output_sink_string> logger(buffer);
+
+            std::vector<std::thread> threads;
+            for (int t=0; t < 4; ++t) {
+                threads.emplace_back([&logger] {
+                    for (int i=0; i < 10000; ++i) {
+                        logger.put_metrics_value<"requests">(1);
+                        logger.put_metrics_value<"bytes">(0.5);
+                        logger.put_metrics_value<"queue_depth">(7);
+                    }
+                });
+            }
+            for (auto& thread: threads)
+                thread.join();
+        }
+
+        auto test_data = split_string_by_newline(buffer);
+        REQUIRE(test_data.size() == 1);
+        REQUIRE(test_data[0]["requests"] == 40000);
+        REQUIRE(test_data[0]["bytes"] == 20000);
+        REQUIRE(test_data[0]["queue_depth"] == 7);
+        REQUIRE(!test_data[0].contains("unset"));
+        REQUIRE(test_data[0]["_aws"]["CloudWatchMetrics"][0]["Metrics"].size() == 3);
+    }
+
+    SECTION("Merging metrics") {
+        cw_emf::metrics<
+                cw_emf::metric<"latency", cw_emf::unit::Milliseconds>,
+                cw_emf::metric<"status", cw_emf::unit::None, int, cw_emf::values_counts>,
+                cw_emf::bounded_metric<"size", cw_emf::unit::Bytes, 3, int, cw_emf::overflow::count>,
+                cw_emf::histogram_metric<"duration", cw_emf::unit::Seconds>,
+                cw_emf::stat_metric<"queue_time", cw_emf::unit::Milliseconds>,
+                cw_emf::counter_metric<"requests", cw_emf::unit::Count>,
+                cw_emf::gauge_metric<"connections", cw_emf::unit::Count>> first, second;
+
+        first.put_value<0>(1.5);
+        second.put_value<0>(2.5);
+        first.put_value<1>(200);
+        second.put_value<1>(200);
+        second.put_value<1>(500);
+        for (int i=0; i < 2; ++i) {
+            first.put_value<2>(i);
+            second.put_value<2>(i + 10);
+        }
+        first.put_value<3>(1.0);
+        second.put_value<3>(1.0);
+        second.put_value<3>(8.0);
+        first.put_value<4>(3.0);
+        second.put_value<4>(1.0);
+        second.put_value<4>(2.0);
+        first.put_value<5>(2);
+        second.put_value<5>(3);
+        second.put_value<6>(42.0);
+
+        first.merge(second);
+
+        REQUIRE(first.metric_at<0>().value_at(1) == 2.5);
+        REQUIRE(first.metric_at<1>().size() == 2);
+        REQUIRE(first.metric_at<1>().count_at(0) == 2);
+        REQUIRE(first.metric_at<2>().size() == 3);
+        REQUIRE(first.metric_at<2>().value_at(2) == 10);
+        REQUIRE(first.metric_at<2>().overflows() == 1);
+        REQUIRE(first.metric_at<3>().size() == 2);
+        REQUIRE(first.metric_at<3>().count_at(0) == 2);
+        REQUIRE(first.metric_at<4>().count() == 3);
+        REQUIRE(first.metric_at<4>().min() == 1.0);
+        REQUIRE(first.metric_at<4>().sum() == 6.0);
+        REQUIRE(first.metric_at<5>().value_at(0) == 5);
+        REQUIRE(first.metric_at<6>().value_at(0) == 42.0);
+
+        cw_emf::packed_metrics<cw_emf::bounded_metric<"size", cw_emf::unit::Bytes, 3, int, cw_emf::overflow::count>> packed_first, packed_second;
+        for (int i=0; i < 2; ++i) {
+            packed_first.put_value<0>(i);
+            packed_second.put_value<0>(i + 10);
+        }
+        packed_first.merge(packed_second);
+        REQUIRE(packed_first.metric_at<0>().value_at(2) == 10);
+        REQUIRE(packed_first.metric_at<0>().overflows() == 1);
+    }
+
+    SECTION("Sharded logger") {
+        auto log = [](auto& logger, int threads) {
+            std::vector<std::thread> workers;
+            for (int t=0; t < threads; ++t) {
+                workers.emplace_back([&logger, t] {
+                    for (int i=0; i < 1000; ++i) {
+                        logger.template put_metrics_value<"status">(200 + i % 4);
+                        logger.template put_metrics_value<"latency">(t * 1000 + i);
+                        logger.template put_metrics_value<1>(1);
+                    }
+                });
+            }
+            for (auto& worker: workers)
+                worker.join();
+        };
+
+        auto check = [](const std::string& buffer, int threads) {
+            auto test_data = split_string_by_newline(buffer);
+            REQUIRE(test_data.size() == 1);
+            REQUIRE(test_data[0]["status"]["Values"] == std::vector<int>{200, 201, 202, 203});
+            REQUIRE(test_data[0]["status"]["Counts"] == std::vector<int>(4, threads * 250));
+            REQUIRE(test_data[0]["latency"]["Counts"] == std::vector<int>{1, threads * 1000 - 2, 1});
+            REQUIRE(test_data[0]["latency"]["Values"][2] == threads * 1000 - 1);
+            REQUIRE(test_data[0]["requests"] == threads * 1000);
+            REQUIRE(test_data[0]["request_id"] == "req_abs_123");
+        };
+
+        std::string buffer;
+        {
+            cw_emf::sharded_logger<"test_ns",
+                    cw_emf::metrics<
+                        cw_emf::metric<"status", cw_emf::unit::None, int, cw_emf::values_counts>,
+                        cw_emf::counter_metric<"requests", cw_emf::unit::Count>,
+                        cw_emf::stat_metric<"latency", cw_emf::unit::Milliseconds>>,
+                    cw_emf::dimensions<cw_emf::dimension<"request_id">>,
+                    cw_emf::log_messages<>,
+                    cw_emf::output_sink_string> logger(buffer);
+
+            logger.dimension_value<"request_id">("req_abs_123");
+            log(logger, 8);
+            logger.flush();
+            check(buffer, 8);
+
+            buffer.clear();
+            log(logger, 2);
+            logger.flush();
+            check(buffer, 2);
+        }
+
+        // more threads than shards, the rest share one
+        buffer.clear();
+        {
+            cw_emf::sharded_logger<"test_ns",
+                    cw_emf::metrics<
+                        cw_emf::metric<"status", cw_emf::unit::None, int, cw_emf::values_counts>,
+                        cw_emf::counter_metric<"requests", cw_emf::unit::Count>,
+                        cw_emf::stat_metric<"latency", cw_emf::unit::Milliseconds>>,
+                    cw_emf::dimensions<cw_emf::dimension<"request_id">>,
+                    cw_emf::log_messages<>,
+                    cw_emf::output_sink_string,
+                    2> logger(buffer);
+
+            logger.dimension_value<"request_id">("req_abs_123");
+            log(logger, 6);
+        }
+        check(buffer, 6);
+
+        // periodic flushes while the workers keep putting, with the merged metrics from a memory resource
+        buffer.clear();
+        counting_resource heap;
+        std::pmr::unsynchronized_pool_resource pool(&heap);
+        {
+            cw_emf::sharded_logger<"test_ns",
+                    cw_emf::metrics<
+                        cw_emf::counter_metric<"requests", cw_emf::unit::Count>,
+                        cw_emf::metric<"status", cw_emf::unit::None, int, cw_emf::values_counts>>,
+                    cw_emf::dimensions<>,
+                    cw_emf::log_messages<>,
+                    cw_emf::output_sink_string,
+                    2> logger(std::allocator_arg, &pool, buffer);
+
+            std::atomic<int> finished{0};
+            std::vector<std::thread> workers;
+            for (int t=0; t < 3; ++t) {
+                workers.emplace_back([&] {
+                    for (int i=0; i < 20000; ++i) {
+                        logger.put_metrics_value<"requests">(1);
+                        logger.put_metrics_value<"status">(200 + i % 2);
+                    }
+                    ++finished;
+                });
+            }
+            while (finished < 3) {
+                logger.flush();
+                std::this_thread::yield();
+            }
+            for (auto& worker: workers)
+                worker.join();
+        }
+
+        std::int64_t requests = 0;
+        std::int64_t statuses = 0;
+        for (auto& message: split_string_by_newline(buffer)) {
+            requests += message.value("requests", std::int64_t{0});
+            if (message.contains("status")) {
+                for (auto& count: message["status"]["Counts"])
+                    statuses += count.get<std::int64_t>();
+            }
+        }
+        REQUIRE(requests == 3 * 20000);
+        REQUIRE(statuses == requests);
+        REQUIRE(heap.allocations > 0);
+    }
+
+    SECTION("Asynchronous sink") {
+        using async_logger = cw_emf::logger<"test_ns",
+                cw_emf::metrics<cw_emf::metric<"latency", cw_emf::unit::Milliseconds>>,
+                cw_emf::dimensions<>,
+                cw_emf::log_messages<cw_emf::log_message<"tracing">>,
+                cw_emf::output_sink_async>;
+
+        std::string output;
+        std::size_t writes{0};
+        {
+            cw_emf::async_writer writer(4096, cw_emf::async_policy::block, [&](std::string_view messages) {
+                output += messages;
+                ++writes;
+            });
+
+            for (int i=0; i < 1000; ++i) {
+                async_logger logger(writer);
+                logger.put_metrics_value<0>(i);
+                logger.log_value<0>(std::to_string(i));
+            }
+            writer.drain();
+
+            auto test_data = split_string_by_newline(output);
+            REQUIRE(test_data.size() == 1000);
+            REQUIRE(test_data[999]["latency"] == 999);
+            REQUIRE(writer.dropped() == 0);
+            INFO("writes: " << writes);
+            REQUIRE(writes <= 1000);
+
+            async_logger too_large(writer);
+            too_large.log_value<0>(std::string(4096, 'x'));
+        }
+
+        auto run = [](cw_emf::async_policy policy) {
+            std::promise<void> release;
+            auto released = release.get_future().share();
+            std::string output;
+
+            cw_emf::async_writer writer(64, policy, [&, released](std::string_view messages) {
+                released.wait();
+                output += messages;
+                output += '|';
+            });
+
+            // The first message is taken right away and stalls the writer, the next ones fill the ring
+            writer.push("first");
+            while (writer.dropped() == 0 && output.empty()) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                if (policy == cw_emf::async_policy::block)
+                    break;
+                writer.push("0123456789");
+            }
+
+            if (policy == cw_emf::async_policy::block) {
+                std::thread producer([&writer] {
+                    for (int i=0; i < 20; ++i)
+                        writer.push("0123456789");
+                });
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                release.set_value();
+                producer.join();
+            } else {
+                writer.push("last456789");
+                release.set_value();
+            }
+
+            writer.drain();
+            return std::pair(output, writer.dropped());
+        };
+
+        auto [blocked, blocked_drops] = run(cw_emf::async_policy::block);
+        REQUIRE(blocked_drops == 0);
+        REQUIRE(std::count(blocked.begin(), blocked.end(), '9') == 20);
+
+        auto [newest, newest_drops] = run(cw_emf::async_policy::drop_newest);
+        REQUIRE(newest_drops > 0);
+        REQUIRE(newest.find("last456789") == std::string::npos);
+
+        auto [oldest, oldest_drops] = run(cw_emf::async_policy::drop_oldest);
+        REQUIRE(oldest_drops > 0);
+        REQUIRE(oldest.ends_with("last456789|"));
+
+        // Dropping while the writer thread copies messages out must neither tear nor lose them
+        std::string lines;
+        std::size_t dropped;
+        {
+            cw_emf::async_writer writer(256, cw_emf::async_policy::drop_oldest, [&lines](std::string_view messages) {
+                lines += messages;
+            });
+            for (int i=0; i < 20000; ++i)
+                writer.push(std::string(20, static_cast<char>('a' + i % 26)) + "\n");
+            writer.drain();
+            dropped = writer.dropped();
+        }
+        std::size_t written = 0;
+        for (std::size_t start = 0; start < lines.size(); start += 21, ++written) {
+            INFO("line " << written);
+            REQUIRE(lines.substr(start, 21) == std::string(20, lines[start]) + "\n");
+        }
+        REQUIRE(written + dropped == 20000);
+    }
+
+
     //        std::cout << emf_message.dump(3) << "\n";
 }
 
@@ -276,7 +1492,7 @@ TEST_CASE("Create Metric Benchmark", "[benchmark]") {
 
         cw_emf::logger<"test_ns",
                 cw_emf::metrics<
-                        cw_emf::metric<"test_metric", Aws::CloudWatch::Model::StandardUnit::Count>>,
+                        cw_emf::metric<"test_metric", cw_emf::unit::Count>>,
                 cw_emf::dimensions<
                         cw_emf::dimension<"version">,
                         cw_emf::dimension_fixed<"function_name", "my_lambda_fun">>,
@@ -284,13 +1500,14 @@ TEST_CASE("Create Metric Benchmark", "[benchmark]") {
                 cw_emf::output_sink_null> logger;
 
       logger.put_metrics_value<0>(34);
+      Catch::Benchmark::keep_memory(&logger);
    };
 
     BENCHMARK("Metric By Name, no output") {
        cw_emf::logger<"test_ns",
                cw_emf::metrics<
-                       cw_emf::metric<"test_metric", Aws::CloudWatch::Model::StandardUnit::Count, int>,
-                       cw_emf::metric<"transfer_speed", Aws::CloudWatch::Model::StandardUnit::Bytes_Second>>,
+                       cw_emf::metric<"test_metric", cw_emf::unit::Count, int>,
+                       cw_emf::metric<"transfer_speed", cw_emf::unit::Bytes_Second>>,
                cw_emf::dimensions<
                        cw_emf::dimension<"version">,
                        cw_emf::dimension_fixed<"function_name", "my_lambda_fun">>,
@@ -300,11 +1517,12 @@ TEST_CASE("Create Metric Benchmark", "[benchmark]") {
 
        logger.put_metrics_value<"test_metric">(82);
        logger.put_metrics_value<"transfer_speed">(1047.456);
+       Catch::Benchmark::keep_memory(&logger);
     };
 
     BENCHMARK("150 Metrics, no output") {
         cw_emf::logger<"test_ns",
-                cw_emf::metrics<cw_emf::metric<"test_metric", Aws::CloudWatch::Model::StandardUnit::Count, int>>,
+                cw_emf::metrics<cw_emf::metric<"test_metric", cw_emf::unit::Count, int>>,
                 cw_emf::dimensions<>,
                 cw_emf::log_messages<>,
                 cw_emf::output_sink_null> logger;
@@ -318,7 +1536,7 @@ TEST_CASE("Create Metric Benchmark", "[benchmark]") {
         std::string buffer;
         cw_emf::logger<"test_ns",
                 cw_emf::metrics<
-                        cw_emf::metric<"test_metric", Aws::CloudWatch::Model::StandardUnit::Count>>,
+                        cw_emf::metric<"test_metric", cw_emf::unit::Count>>,
                 cw_emf::dimensions<
                         cw_emf::dimension<"version">,
                         cw_emf::dimension_fixed<"function_name", "my_lambda_fun">>,
@@ -336,8 +1554,8 @@ TEST_CASE("Create Metric Benchmark", "[benchmark]") {
         std::string buffer;
         cw_emf::logger<"test_ns",
                 cw_emf::metrics<
-                        cw_emf::metric<"test_metric", Aws::CloudWatch::Model::StandardUnit::Count, int>,
-                        cw_emf::metric<"transfer_speed", Aws::CloudWatch::Model::StandardUnit::Bytes_Second>>,
+                        cw_emf::metric<"test_metric", cw_emf::unit::Count, int>,
+                        cw_emf::metric<"transfer_speed", cw_emf::unit::Bytes_Second>>,
                 cw_emf::dimensions<
                         cw_emf::dimension<"version">,
                         cw_emf::dimension_fixed<"function_name", "my_lambda_fun">>,
@@ -354,11 +1572,306 @@ TEST_CASE("Create Metric Benchmark", "[benchmark]") {
         return buffer;
    };
 
+    // Catch only reports time, the allocator calls of one request are reported alongside
+    auto allocator_calls = [](auto&& request) {
+        auto before = global_allocations.load();
+        request();
+        return global_allocations.load() - before;
+    };
+    WARN("global operator new calls per request, default resource: " << allocator_calls([] {
+        std::pmr::string buffer;
+        request_logger logger(buffer);
+        log_request(logger);
+        logger.flush();
+    }) << ", monotonic buffer: " << allocator_calls([] {
+        std::array<std::byte, 8192> stack;
+        std::pmr::monotonic_buffer_resource arena(stack.data(), stack.size());
+        std::pmr::string buffer(&arena);
+        request_logger logger(std::allocator_arg, &arena, buffer);
+        log_request(logger);
+        logger.flush();
+    }));
+
+    BENCHMARK("Per request logger, default resource") {
+        std::pmr::string buffer;
+        request_logger logger(buffer);
+        log_request(logger);
+        logger.flush();
+        return buffer.size();
+    };
+
+    BENCHMARK("Per request logger, monotonic buffer") {
+        std::array<std::byte, 8192> stack;
+        std::pmr::monotonic_buffer_resource arena(stack.data(), stack.size());
+        std::pmr::string buffer(&arena);
+        request_logger logger(std::allocator_arg, &arena, buffer);
+        log_request(logger);
+        logger.flush();
+        return buffer.size();
+    };
+
+    BENCHMARK_ADVANCED("Per request logger, stdio to /dev/null")(Catch::Benchmark::Chronometer meter) {
+        std::FILE* null = std::fopen("/dev/null", "w");
+        meter.measure([null] {
+            std::pmr::string buffer;
+            {
+                request_logger logger(buffer);
+                log_request(logger);
+            }
+            std::fputs(buffer.c_str(), null);
+            std::fflush(null);
+        });
+        std::fclose(null);
+    };
+
+    BENCHMARK_ADVANCED("Per request logger, async sink to /dev/null")(Catch::Benchmark::Chronometer meter) {
+        std::FILE* null = std::fopen("/dev/null", "w");
+        {
+            cw_emf::async_writer writer(1 << 20, cw_emf::async_policy::block, [null](std::string_view messages) {
+                std::fwrite(messages.data(), 1, messages.size(), null);
+                std::fflush(null);
+            });
+            meter.measure([&writer] {
+                cw_emf::logger<"test_ns",
+                        cw_emf::metrics<
+                            cw_emf::metric<"latency", cw_emf::unit::Milliseconds>,
+                            cw_emf::metric<"count", cw_emf::unit::Count, int>>,
+                        cw_emf::dimensions<
+                            cw_emf::dimension_fixed<"version", "$LATEST">,
+                            cw_emf::dimension<"request_id">>,
+                        cw_emf::log_messages<cw_emf::log_message<"tracing">>,
+                        cw_emf::output_sink_async> logger(writer);
+                for (int i=0; i < 20; ++i)
+                    logger.put_metrics_value<"latency">(i * 1.5);
+                logger.put_metrics_value<"count">(20);
+                logger.dimension_value<"request_id">("7c1c8a5e-4d1a-4a6f-9b0e-3f7c8d2e1a90");
+                logger.log_value<"tracing">("request handled by the order service, all downstream calls succeeded");
+            });
+        }
+        std::fclose(null);
+    };
+
+    auto log_line = [](std::size_t size) {
+        std::string line;
+        while (line.size() < size)
+            line += "2022-02-19T10:15:42.123Z INFO request handled path=/api/v1/orders status=200 user=\"jdoe\"\t";
+        line.resize(size);
+        return line;
+    };
+
+    for (std::size_t size: {64, 1024, 16384}) {
+        auto line = log_line(size);
+
+        BENCHMARK("Log message " + std::to_string(size) + " bytes") {
+            std::string buffer;
+            cw_emf::output_sink_string sink(buffer);
+            sink.write_value(std::string_view(line));
+            return buffer;
+        };
+
+        BENCHMARK("Log message " + std::to_string(size) + " bytes, UTF-8 validation") {
+            std::string buffer;
+            cw_emf::output_sink_string sink(buffer, true);
+            sink.write_value(std::string_view(line));
+            return buffer;
+        };
+
+        BENCHMARK("Log message " + std::to_string(size) + " bytes, scan") {
+            std::size_t escapes{0};
+            for (std::string_view rest(line); !rest.empty(); rest.remove_prefix(1)) {
+                rest.remove_prefix(cw_emf::internal::find_escape(rest, false));
+                if (rest.empty())
+                    break;
+                ++escapes;
+            }
+            return escapes;
+        };
+
+        BENCHMARK("Log message " + std::to_string(size) + " bytes, scalar scan") {
+            std::size_t escapes{0};
+            for (std::string_view rest(line); !rest.empty(); rest.remove_prefix(1)) {
+                rest.remove_prefix(cw_emf::internal::find_escape_scalar(rest, false));
+                if (rest.empty())
+                    break;
+                ++escapes;
+            }
+            return escapes;
+        };
+    }
+
+    auto wide_logger = [&]<template<typename...> typename metrics_t, template<auto> typename metric_t>(auto&&... sink_args) {
+        return [&]<std::size_t... index>(std::index_sequence<index...>) {
+            using sink_t = std::conditional_t<sizeof...(sink_args) == 0, cw_emf::output_sink_null, cw_emf::output_sink_string>;
+            using logger_t = cw_emf::logger<"test_ns",
+                    metrics_t<metric_t<wide_metric_name<index>()>...>,
+                    cw_emf::dimensions<>,
+                    cw_emf::log_messages<>,
+                    sink_t>;
+            logger_t logger(sink_args...);
+
+            for (int i=0; i < 8; ++i)
+                (logger.template put_metrics_value<int{index}>(i * 0.25), ...);
+            logger.flush();
+            Catch::Benchmark::keep_memory(&logger);
+        }(std::make_index_sequence<wide_metrics>{});
+    };
+
+    BENCHMARK("64 Metrics, metric, no output") {
+        wide_logger.template operator()<cw_emf::metrics, wide_metric>();
+    };
+
+    BENCHMARK("64 Metrics, bounded_metric, no output") {
+        wide_logger.template operator()<cw_emf::metrics, wide_bounded_metric>();
+    };
+
+    BENCHMARK("64 Metrics, packed_metrics, no output") {
+        wide_logger.template operator()<cw_emf::packed_metrics, wide_bounded_metric>();
+    };
+
+    BENCHMARK("64 Metrics, metric") {
+        std::string buffer;
+        wide_logger.template operator()<cw_emf::metrics, wide_metric>(buffer);
+        return buffer;
+    };
+
+    BENCHMARK("64 Metrics, packed_metrics") {
+        std::string buffer;
+        wide_logger.template operator()<cw_emf::packed_metrics, wide_bounded_metric>(buffer);
+        return buffer;
+    };
+
+    BENCHMARK("1000 values, 4 distinct") {
+        std::string buffer;
+        {
+            cw_emf::logger<"test_ns",
+                    cw_emf::metrics<cw_emf::metric<"status", cw_emf::unit::None, int>>,
+                    cw_emf::dimensions<>,
+                    cw_emf::log_messages<>,
+                    cw_emf::output_sink_string> logger(buffer);
+
+            for (int i=0; i < 1000; ++i)
+                logger.put_metrics_value<0>(200 + i % 4);
+        }
+        return buffer;
+    };
+
+    BENCHMARK("1000 values, 4 distinct, values and counts") {
+        std::string buffer;
+        {
+            cw_emf::logger<"test_ns",
+                    cw_emf::metrics<cw_emf::metric<"status", cw_emf::unit::None, int, cw_emf::values_counts>>,
+                    cw_emf::dimensions<>,
+                    cw_emf::log_messages<>,
+                    cw_emf::output_sink_string> logger(buffer);
+
+            for (int i=0; i < 1000; ++i)
+                logger.put_metrics_value<0>(200 + i % 4);
+        }
+        return buffer;
+    };
+
+    BENCHMARK_ADVANCED("Histogram put")(Catch::Benchmark::Chronometer meter) {
+        cw_emf::histogram_metric<"latency", cw_emf::unit::Milliseconds> latency;
+        double value = 0.5;
+        meter.measure([&] {
+            for (int i=0; i < 1000; ++i) {
+                latency.put_value(value);
+                value = value * 1.618 + (value > 1e6 ? -1e6 : 0);
+            }
+        });
+        return latency.size();
+    };
+
+    BENCHMARK_ADVANCED("Sketch put")(Catch::Benchmark::Chronometer meter) {
+        cw_emf::sketch_metric<"latency", cw_emf::unit::Milliseconds> latency;
+        double value = 0.5;
+        meter.measure([&] {
+            for (int i=0; i < 1000; ++i) {
+                latency.put_value(value);
+                value = value * 1.618 + (value > 1e6 ? -1e6 : 0);
+            }
+        });
+        return latency.size();
+    };
+
+    BENCHMARK("150 Metrics, statistic set") {
+        std::string buffer;
+
+        cw_emf::logger<"test_ns",
+                cw_emf::metrics<cw_emf::stat_metric<"test_metric", cw_emf::unit::Count, int>>,
+                cw_emf::dimensions<>,
+                cw_emf::log_messages<>,
+                cw_emf::output_sink_string> logger(buffer);
+
+        for (int i=0; i < 150; ++i) {
+            logger.put_metrics_value<0>(i + 1);
+        }
+
+        logger.flush();
+        return buffer;
+    };
+
+    using sharded_metrics = cw_emf::metrics<
+            cw_emf::stat_metric<"latency", cw_emf::unit::Milliseconds>,
+            cw_emf::metric<"status", cw_emf::unit::None, int, cw_emf::values_counts>>;
+
+    auto run_threads = [](int threads, auto&& put) {
+        std::vector<std::thread> workers;
+        for (int t=0; t < threads; ++t) {
+            workers.emplace_back([&put] {
+                for (int i=0; i < 10000; ++i)
+                    put(i);
+            });
+        }
+        for (auto& worker: workers)
+            worker.join();
+    };
+
+    // The cost of a put itself, without starting threads
+    BENCHMARK_ADVANCED("Sharded logger, 10000 puts on one thread")(Catch::Benchmark::Chronometer meter) {
+        cw_emf::sharded_logger<"test_ns", sharded_metrics, cw_emf::dimensions<>, cw_emf::log_messages<>, cw_emf::output_sink_null> logger;
+        meter.measure([&logger] {
+            for (int i=0; i < 10000; ++i)
+                logger.put_metrics_value<0>(i * 0.5);
+        });
+    };
+
+    BENCHMARK_ADVANCED("Logger, 10000 puts on one thread")(Catch::Benchmark::Chronometer meter) {
+        cw_emf::logger<"test_ns", sharded_metrics, cw_emf::dimensions<>, cw_emf::log_messages<>, cw_emf::output_sink_null> logger;
+        meter.measure([&logger] {
+            for (int i=0; i < 10000; ++i)
+                logger.put_metrics_value<0>(i * 0.5);
+        });
+    };
+
+    int max_threads = std::max(8, static_cast<int>(std::thread::hardware_concurrency()));
+    for (int threads=1; threads <= max_threads; threads *= 2) {
+        BENCHMARK("Sharded logger, " + std::to_string(threads) + " threads") {
+            cw_emf::sharded_logger<"test_ns", sharded_metrics, cw_emf::dimensions<>, cw_emf::log_messages<>, cw_emf::output_sink_null> logger;
+            run_threads(threads, [&logger](int i) {
+                logger.put_metrics_value<0>(i * 0.5);
+                logger.put_metrics_value<1>(200 + i % 4);
+            });
+            logger.flush();
+        };
+
+        BENCHMARK("Logger behind a mutex, " + std::to_string(threads) + " threads") {
+            cw_emf::logger<"test_ns", sharded_metrics, cw_emf::dimensions<>, cw_emf::log_messages<>, cw_emf::output_sink_null> logger;
+            std::mutex mutex;
+            run_threads(threads, [&logger, &mutex](int i) {
+                std::lock_guard lock(mutex);
+                logger.put_metrics_value<0>(i * 0.5);
+                logger.put_metrics_value<1>(200 + i % 4);
+            });
+            logger.flush();
+        };
+    }
+
     BENCHMARK("150 Metrics") {
         std::string buffer;
 
         cw_emf::logger<"test_ns",
-                cw_emf::metrics<cw_emf::metric<"test_metric", Aws::CloudWatch::Model::StandardUnit::Count, int>>,
+                cw_emf::metrics<cw_emf::metric<"test_metric", cw_emf::unit::Count, int>>,
                 cw_emf::dimensions<>,
                 cw_emf::log_messages<>,
                 cw_emf::output_sink_string> logger(buffer);